@@ -0,0 +1,920 @@
+// Copyright 2013 by Chris Dyer
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "src/aligner.h"
+
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "src/numa.h"
+#include "src/perf_counter.h"
+#include "src/posterior.h"
+#include "src/da.h"
+
+using namespace std;
+
+namespace {
+
+struct PairHash {
+  size_t operator()(const pair<short, short>& x) const {
+    return (unsigned short) x.first << 16 | (unsigned) x.second;
+  }
+};
+
+// where the messages go with AlignerOptions::log == NULL (a stream without
+// a buffer discards everything)
+ostream null_log(NULL);
+
+ostream& Log(const AlignerOptions& opts) {
+  return opts.log ? *opts.log : null_log;
+}
+
+// Orders the lines of every batch by decreasing E-step cost (the number of
+// alignment cells), so that the dynamically scheduled threads start on the
+// long sentences and the end of a batch is made of short ones instead of
+// leaving all but one thread waiting at the barrier. With a single thread
+// the order is left empty, i.e. file order.
+void ScheduleBatches(const vector<unsigned>& cost, const size_t batch_size,
+    vector<unsigned>* order) {
+  order->clear();
+  int threads = 1;
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#endif
+  if (threads < 2) return;
+  order->resize(cost.size());
+  for (size_t first = 0; first < cost.size(); first += batch_size) {
+    const size_t last = min(cost.size(), first + batch_size);
+    for (size_t k = first; k < last; ++k) (*order)[k] = k;
+    stable_sort(order->begin() + first, order->begin() + last,
+        [&cost](unsigned a, unsigned b) { return cost[a] > cost[b]; });
+  }
+}
+
+inline void AddTranslationOptions(vector<vector<unsigned> >& insert_buffer,
+    TTable* s2t) {
+  s2t->SetMaxE(insert_buffer.size()-1);
+#pragma omp parallel for schedule(dynamic)
+  for (unsigned e = 0; e < insert_buffer.size(); ++e) {
+    for (unsigned f : insert_buffer[e]) {
+      s2t->Insert(e, f);
+    }
+    insert_buffer[e].clear();
+  }
+}
+
+// Collapses exact duplicate lines: *unique gets the distinct lines in the
+// order of their first occurrence, (*weights)[u] the number of copies of
+// unique line u and (*unique_of)[i] the unique line of line i.
+void CollapseDuplicates(const vector<StringPiece>& lines,
+    vector<StringPiece>* unique, vector<unsigned>* weights,
+    vector<unsigned>* unique_of) {
+  vector<uint64_t> hash(lines.size());
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (size_t i = 0; i < lines.size(); ++i) {
+    uint64_t h = 14695981039346656037ULL;  // FNV-1a
+    for (size_t k = 0; k < lines[i].size; ++k) {
+      h ^= static_cast<unsigned char>(lines[i].data[k]);
+      h *= 1099511628211ULL;
+    }
+    hash[i] = h;
+  }
+  size_t mask = 1023;
+  while (mask < 2 * lines.size()) mask = 2 * mask + 1;
+  vector<unsigned> table(mask + 1, ~0u);  // ids of unique lines
+  vector<uint64_t> unique_hash;
+  unique->clear();
+  weights->clear();
+  unique_of->resize(lines.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const StringPiece& line = lines[i];
+    size_t b = hash[i] & mask;
+    for (; table[b] != ~0u; b = (b + 1) & mask) {
+      const StringPiece& u = (*unique)[table[b]];
+      if (unique_hash[table[b]] == hash[i] && u.size == line.size &&
+          memcmp(u.data, line.data, line.size) == 0)
+        break;
+    }
+    if (table[b] == ~0u) {
+      table[b] = unique->size();
+      unique->push_back(line);
+      unique_hash.push_back(hash[i]);
+      weights->push_back(0);
+    }
+    ++(*weights)[table[b]];
+    (*unique_of)[i] = table[b];
+  }
+}
+
+PosteriorOptions MakePosteriorOptions(const AlignerOptions& o, unsigned kNULL) {
+  PosteriorOptions opts;
+  opts.kNULL = kNULL;
+  opts.prob_align_null = o.prob_align_null;
+  opts.diagonal_tension = o.diagonal_tension;
+  opts.band_epsilon = o.band_epsilon;
+  return opts;
+}
+
+// the links of viterbi (as set by Posterior::Run) in corpus orientation
+void CollectLinks(const vector<unsigned>& viterbi, const bool reverse,
+    vector<Alignment::Link>* links) {
+  links->clear();
+  for (unsigned j = 0; j < viterbi.size(); ++j) {
+    if (!viterbi[j]) continue;
+    if (reverse)
+      links->push_back(Alignment::Link(j, viterbi[j] - 1));
+    else
+      links->push_back(Alignment::Link(viterbi[j] - 1, j));
+  }
+}
+
+}  // namespace
+
+string AlignerOptions::Check() const {
+  if (variational_bayes && alpha <= 0.0)
+    return "--alpha must be > 0";
+  if (tolerance < 0)
+    return "--tolerance must be >= 0";
+  if (band_epsilon < 0 || band_epsilon >= 1)
+    return "--band_epsilon must be in [0, 1)";
+  if (numa != "off" && numa != "interleave" && numa != "firsttouch")
+    return "--numa must be interleave, firsttouch or off";
+  if (sketch_min_count > 65535)
+    return "--sketch_min_count must be at most 65535";
+  if (sketch_min_count && (sketch_epsilon <= 0 || sketch_epsilon >= 1))
+    return "--sketch_epsilon must be in (0, 1)";
+  if (sketch_min_count && (sketch_delta <= 0 || sketch_delta >= 1))
+    return "--sketch_delta must be in (0, 1)";
+  return "";
+}
+
+Aligner::Aligner(const AlignerOptions& opts) : opts_(opts) {
+  kNULL_ = d_.Convert("<eps>");
+  kDIV_ = d_.Convert("|||");
+}
+
+bool Aligner::SetUpNuma() const {
+  if (opts_.numa == "off") return false;
+  NumaTopology topology;
+  if (!topology.PinThreads())
+    Log(opts_) << "warning: could not pin threads to CPUs\n";
+  Log(opts_) << "NUMA: " << topology.Describe() << ", threads pinned, "
+             << opts_.numa << " translation table placement\n";
+  return opts_.numa == "interleave";
+}
+
+bool Aligner::LoadModel(const string& filename) {
+  if (CompactTTable::IsCompact(filename)) {
+    if (!compact_.Open(filename, &d_)) return false;
+    kNULL_ = d_.Lookup(StringPiece("<eps>", 5));
+    kDIV_ = d_.Lookup(StringPiece("|||", 3));
+    Log(opts_) << "Loaded " << compact_.num_entries()
+               << " translation parameters (" << compact_.bits()
+               << "-bit compact model).\n";
+    return true;
+  }
+  ifstream in(filename.c_str());
+  if (!in) return false;
+  NumaTopology topology;
+  const bool interleave = SetUpNuma();
+  if (interleave) topology.InterleaveAllocations();
+  const size_t entries = s2t_.DeserializeLogProbsFromText(&in, d_);
+  if (interleave) topology.LocalAllocations();
+  Log(opts_) << "Loaded " << entries << " translation parameters.\n";
+  return true;
+}
+
+bool Aligner::SaveModel(const string& filename) const {
+  if (!compact_.empty()) return false;
+  ofstream test(filename.c_str());
+  if (!test) return false;
+  test.close();
+  // ExportToFile takes a mutable Dict but doesn't change it
+  s2t_.ExportToFile(filename.c_str(), const_cast<Dict&>(d_),
+                    opts_.beam_threshold);
+  return true;
+}
+
+bool Aligner::SaveCompactModel(const string& filename, int bits) const {
+  if (!compact_.empty()) return false;
+  return CompactTTable::Write(s2t_, d_, opts_.beam_threshold, bits, filename);
+}
+
+void Aligner::ParseLine(const StringPiece& line, vector<unsigned>* src,
+                        vector<unsigned>* trg, bool frozen) {
+  vector<unsigned> tmp;
+  src->clear();
+  trg->clear();
+  d_.ConvertWhitespaceDelimitedLine(line, kDIV_, &tmp, frozen);
+  unsigned i = 0;
+  while (i < tmp.size() && tmp[i] != kDIV_) {
+    src->push_back(tmp[i]);
+    ++i;
+  }
+  if (i < tmp.size() && tmp[i] == kDIV_) {
+    ++i;
+    for (; i < tmp.size(); ++i)
+      trg->push_back(tmp[i]);
+  }
+}
+
+void Aligner::LookUpLine(const StringPiece& line, vector<unsigned>* src,
+                         vector<unsigned>* trg, vector<StringPiece>* src_words,
+                         vector<StringPiece>* trg_words) const {
+  static const StringPiece kSeparator("|||", 3);
+  src->clear();
+  trg->clear();
+  if (src_words) src_words->clear();
+  if (trg_words) trg_words->clear();
+  vector<unsigned>* ids = src;
+  vector<StringPiece>* words = src_words;
+  // the same tokens as ParseLine: a tab also separates the sentences
+  size_t i = 0;
+  while (i < line.size) {
+    StringPiece word = kSeparator;
+    unsigned id = kDIV_;
+    if (Dict::is_ws(line.data[i])) {
+      if (line.data[i++] != '\t') continue;
+    } else {
+      const size_t start = i;
+      while (i < line.size && !Dict::is_ws(line.data[i])) ++i;
+      word = StringPiece(line.data + start, i - start);
+      id = d_.Lookup(word);
+    }
+    if (id == kDIV_ && ids == src) {
+      ids = trg;
+      words = trg_words;
+      continue;
+    }
+    ids->push_back(id);
+    if (words) words->push_back(word);
+  }
+}
+
+void Aligner::LookUpWords(const StringPiece& sentence,
+                          vector<unsigned>* ids) const {
+  ids->clear();
+  size_t i = 0;
+  while (i < sentence.size) {
+    if (Dict::is_ws(sentence.data[i])) {
+      ++i;
+      continue;
+    }
+    const size_t start = i;
+    while (i < sentence.size && !Dict::is_ws(sentence.data[i])) ++i;
+    ids->push_back(d_.Lookup(StringPiece(sentence.data + start, i - start)));
+  }
+}
+
+void Aligner::AlignBatch(const vector<SentencePair>& pairs,
+                         vector<AlignmentResult>* results) const {
+  results->resize(pairs.size());
+  const PosteriorFn posterior =
+      SelectPosterior(opts_.use_null, opts_.favor_diagonal, true, true);
+  const CompactPosteriorFn compact_posterior =
+      SelectCompactPosterior(opts_.use_null, opts_.favor_diagonal);
+  const bool compact = !compact_.empty();
+  const PosteriorOptions opts = MakePosteriorOptions(opts_, kNULL_);
+  // safe_prob only reads the table
+  TTable* s2t = const_cast<TTable*>(&s2t_);
+  const int n = pairs.size();
+#pragma omp parallel if(n > 1)
+  {
+    vector<unsigned> src, trg, viterbi;
+    vector<double> probs;
+#pragma omp for schedule(dynamic)
+    for (int k = 0; k < n; ++k) {
+      const SentencePair& p = pairs[k];
+      AlignmentResult& r = (*results)[k];
+      r.src_size = p.src.size;
+      r.trg_size = p.trg.size;
+      r.links.clear();
+      r.log_prob = 0;
+      if (p.src.size == 0 || p.trg.size == 0) continue;
+      src.assign(p.src.words, p.src.words + p.src.size);
+      trg.assign(p.trg.words, p.trg.words + p.trg.size);
+      if (opts_.reverse)
+        swap(src, trg);
+      r.log_prob = Md::log_poisson(trg.size(), 0.05 + src.size() * opts_.mean_srclen_multiplier);
+      if (compact)
+        r.log_prob += compact_posterior(src, trg, 1.0, opts, &compact_,
+                                        &probs, NULL, &viterbi);
+      else
+        r.log_prob += posterior(src, trg, 1.0, opts, s2t, &probs, NULL,
+                                &viterbi);
+      CollectLinks(viterbi, opts_.reverse, &r.links);
+    }
+  }
+}
+
+void Aligner::CollectModelStats(StatsRecord* model) const {
+  if (!compact_.empty()) {
+    model->Set("ttable_entries", compact_.num_entries());
+    model->Set("ttable_bytes", compact_.memory_bytes());
+    model->Set("quantize_bits", compact_.bits());
+    model->Set("dict_bytes", d_.size_in_bytes());
+    return;
+  }
+  const RowArena::Stats rs = s2t_.allocator_stats();
+  model->Set("ttable_entries", s2t_.num_entries());
+  model->Set("ttable_bytes", s2t_.memory_bytes());
+  model->Set("dense_rows", s2t_.num_dense_rows());
+  if (s2t_.has_tail()) {
+    model->Set("sketch_bytes", s2t_.tail_memory_bytes());
+    model->Set("sketch_width", s2t_.tail().width());
+    model->Set("sketch_depth", s2t_.tail().depth());
+  }
+  model->Set("arena_bytes_reserved", rs.bytes_reserved);
+  model->Set("arena_bytes_in_use", rs.bytes_in_use);
+  model->Set("dict_bytes", d_.size_in_bytes());
+}
+
+// sums over the batches of an iteration
+struct Trainer::Batch {
+  Batch()
+      : c0(), emp_feat(), likelihood(), tokens(), cells(), busy(),
+        capacity(), dropped_prior() {}
+  double c0;
+  double emp_feat;
+  double likelihood;
+  double tokens;
+  double cells;
+  double busy;      // time the threads spent on lines
+  double capacity;  // batch time times the threads
+  double dropped_prior;  // largest prior mass left out by band_epsilon
+};
+
+Trainer::Trainer(const AlignerOptions& opts, RunStats* stats)
+    : aligner_(opts), opts_(aligner_.opts_),
+      stats_(stats ? stats : &own_stats_) {}
+
+// processes the batch of lines [first, last) of the corpus, in the order
+// given by order[first, last) if order is not empty, each line counting
+// weights[line] times if weights is not empty; with decode, the links go
+// to (*results)[line - first]
+void Trainer::UpdateFromPairs(const vector<StringPiece>& lines,
+    const vector<unsigned>& order, const vector<unsigned>& weights,
+    const size_t first, const size_t last, const int lc,
+    const bool final_iteration, const bool decode, Batch* b,
+    vector<AlignmentResult>* results) {
+  const int batch_size = static_cast<int>(last - first);
+  if (decode) {
+    results->clear();
+    results->resize(batch_size);
+  }
+  double emp_feat_ = 0.0;
+  double c0_ = 0.0;
+  double likelihood_ = 0.0;
+  double tokens_ = 0.0;
+  double cells_ = 0.0;
+  double busy_ = 0.0;
+  double dropped_ = b->dropped_prior;
+  int team = 1;
+  const PosteriorFn posterior =
+      SelectPosterior(opts_.use_null, opts_.favor_diagonal,
+                      final_iteration && !opts_.fuse_viterbi, false);
+  const PosteriorOptions opts = MakePosteriorOptions(opts_, aligner_.kNULL_);
+  TTable* s2t = &aligner_.s2t_;
+  Timer batch_timer;
+#pragma omp parallel reduction(+:emp_feat_,c0_,likelihood_,tokens_,cells_,busy_) reduction(max:dropped_)
+  {
+#ifdef _OPENMP
+#pragma omp single
+    team = omp_get_num_threads();
+#endif
+    PosteriorTotals totals;
+    vector<unsigned> src, trg, viterbi;
+    vector<double> probs;
+    Timer thread_timer;
+#pragma omp for schedule(dynamic) nowait
+    for (int n = 0; n < batch_size; ++n) {
+      const int line_idx = order.empty() ? n : order[first + n] - first;
+      const StringPiece& line = lines[first + line_idx];
+      aligner_.ParseLine(line, &src, &trg);
+      if (opts_.reverse)
+        swap(src, trg);
+      if (src.size() == 0 || trg.size() == 0) {
+        Log(opts_) << "Error in line " << lc << "\n" << line << endl;
+      }
+      tokens_ += src.size() + trg.size();
+      const double weight = weights.empty() ? 1.0 : weights[first + line_idx];
+      const double local_likelihood =
+          posterior(src, trg, weight, opts, s2t, &probs, &totals,
+                    decode ? &viterbi : NULL);
+      likelihood_ += local_likelihood * weight;
+      if (decode) {
+        AlignmentResult& r = (*results)[line_idx];
+        r.src_size = opts_.reverse ? trg.size() : src.size();
+        r.trg_size = opts_.reverse ? src.size() : trg.size();
+        CollectLinks(viterbi, opts_.reverse, &r.links);
+        r.log_prob = Md::log_poisson(trg.size(), 0.05 + src.size() * opts_.mean_srclen_multiplier);
+        r.log_prob += local_likelihood;
+      }
+    }
+    c0_ += totals.c0;
+    emp_feat_ += totals.emp_feat;
+    cells_ += totals.cells;
+    dropped_ = max(dropped_, totals.dropped_prior);
+    busy_ += thread_timer.Elapsed();
+  }
+  b->emp_feat += emp_feat_;
+  b->c0 += c0_;
+  b->likelihood += likelihood_;
+  b->tokens += tokens_;
+  b->cells += cells_;
+  b->busy += busy_;
+  b->capacity += team * batch_timer.Elapsed();
+  b->dropped_prior = dropped_;
+}
+
+// weights[line] (if not empty) is the number of copies of the line
+void Trainer::InitialPass(const vector<StringPiece>& lines,
+    const vector<unsigned>& weights, double* n_target_tokens,
+    vector<pair<pair<short, short>, unsigned>>* size_counts,
+    vector<unsigned>* line_cost) {
+  ostream& status = Log(opts_);
+  TTable* s2t = &aligner_.s2t_;
+  const unsigned kNULL = aligner_.kNULL_;
+  // With a sketch, the pairs that co-occur fewer than sketch_min_count
+  // times (weighted) get no entries of their own. Their co-occurrences are
+  // counted in a first pass, in a sketch of 16-bit counters (only counts
+  // up to sketch_min_count matter) and kCoocWidth times the width of those
+  // of the table, i.e. their memory, freed before they are allocated: its
+  // estimates are then a lot closer than theirs, and far fewer rare pairs
+  // get entries because of collisions.
+  const unsigned kCoocWidth = 4;
+  CountMinSketch<uint16_t> cooc;
+  size_t width = 0;
+  unsigned depth = 0;
+  double sketched_pairs = 0;
+  if (opts_.sketch_min_count) {
+    width = CountMinSketch<float>::WidthFor(opts_.sketch_epsilon);
+    depth = CountMinSketch<float>::DepthFor(opts_.sketch_delta);
+    cooc.Init(kCoocWidth * width, depth);
+    vector<unsigned> src, trg;
+    for (size_t i = 0; i < lines.size(); ++i) {
+      const unsigned weight = weights.empty() ? 1 : weights[i];
+      aligner_.ParseLine(lines[i], &src, &trg);
+      if (opts_.reverse)
+        swap(src, trg);
+      const uint16_t w = min(weight, 65535u);
+      for (const unsigned e : src)
+        for (const unsigned f : trg)
+          cooc.Add(e, f, w);
+    }
+  }
+  unordered_map<pair<short, short>, unsigned, PairHash> size_counts_;
+  vector<vector<unsigned>> insert_buffer;
+  size_t insert_buffer_items = 0;
+  vector<unsigned> src, trg;
+  bool flag = false;
+  int lc = 0;
+  double n_lines = 0;
+  double tot_len_ratio = 0;
+  status << "INITIAL PASS " << endl;
+  for (const StringPiece& line : lines) {
+    const unsigned weight = weights.empty() ? 1 : weights[lc];
+    lc++;
+    n_lines += weight;
+    if (lc % 1000 == 0) { status << '.'; flag = true; }
+    if (lc %50000 == 0) { status << " [" << lc << "]\n" << flush; flag = false; }
+    aligner_.ParseLine(line, &src, &trg);
+    if (opts_.reverse)
+      swap(src, trg);
+    if (src.size() == 0 || trg.size() == 0) {
+      status << "Error in line " << lc << "\n" << line << endl;
+    }
+    tot_len_ratio += weight * (static_cast<double>(trg.size()) / static_cast<double>(src.size()));
+    *n_target_tokens += weight * trg.size();
+    line_cost->push_back((src.size() + opts_.use_null) * trg.size());
+    if (opts_.use_null) {
+      for (const unsigned f : trg) {
+        s2t->Insert(kNULL, f);
+      }
+    }
+    for (const unsigned e : src) {
+      if (e >= insert_buffer.size()) {
+        insert_buffer.resize(e+1);
+      }
+      if (cooc.empty()) {
+        for (const unsigned f : trg) {
+          insert_buffer[e].push_back(f);
+        }
+      } else {
+        for (const unsigned f : trg) {
+          const unsigned n = cooc.Estimate(e, f);
+          if (n >= opts_.sketch_min_count) {
+            insert_buffer[e].push_back(f);
+          } else {
+            // 1 / n per occurrence adds up to about 1 per distinct pair
+            s2t->AddTailEntries(e, static_cast<double>(weight) / n);
+            sketched_pairs += static_cast<double>(weight) / n;
+          }
+        }
+      }
+      insert_buffer_items += trg.size();
+    }
+    if (insert_buffer_items > opts_.thread_buffer_size * 100) {
+      insert_buffer_items = 0;
+      AddTranslationOptions(insert_buffer, s2t);
+    }
+    size_counts_[make_pair<short, short>(trg.size(), src.size())] += weight;
+  }
+  for (const auto& p : size_counts_) {
+    size_counts->push_back(p);
+  }
+  AddTranslationOptions(insert_buffer, s2t);
+
+  opts_.mean_srclen_multiplier = tot_len_ratio / n_lines;
+  if (flag) {
+    status << endl;
+  }
+  if (!cooc.empty()) {
+    CountMinSketch<uint16_t>().swap(cooc);
+    s2t->EnableTail(width, depth);
+    status << "translation pairs: " << s2t->num_entries() << " exact, about "
+        << static_cast<size_t>(sketched_pairs) << " in a "
+        << width << " x " << depth << " sketch ("
+        << s2t->tail_memory_bytes() / 1048576.0 << " MB)" << endl;
+  }
+  status << "expected target length = source length * " << opts_.mean_srclen_multiplier << endl;
+}
+
+// Renumbers the vocabulary so that word ids decrease with frequency: the
+// rows of frequent source words end up together at the front of the
+// translation table, and rare words (large ids) can be used as sentence
+// signatures. <eps> and ||| keep their ids.
+void Trainer::SortVocabularyByFrequency(const vector<StringPiece>& lines) {
+  Dict& d = aligner_.d_;
+  const unsigned kNULL = aligner_.kNULL_;
+  const unsigned kDIV = aligner_.kDIV_;
+  vector<unsigned> freq(d.max() + 1);
+  vector<unsigned> tokens;
+  for (const StringPiece& line : lines) {
+    d.ConvertWhitespaceDelimitedLine(line, kDIV, &tokens);
+    for (const unsigned w : tokens) {
+      if (w >= freq.size()) freq.resize(w + 1);
+      ++freq[w];
+    }
+  }
+  vector<unsigned> words;
+  for (unsigned w = 1; w <= d.max(); ++w)
+    if (w != kNULL && w != kDIV) words.push_back(w);
+  stable_sort(words.begin(), words.end(),
+      [&freq](unsigned a, unsigned b) { return freq[a] > freq[b]; });
+  Dict sorted;
+  const unsigned ids[2] = { kNULL, kDIV };
+  for (unsigned i = 0; i < 2; ++i) {
+    if (sorted.Convert(d.Convert(ids[i])) != ids[i]) {
+      // <eps> and ||| weren't the first words; leave the ids alone
+      return;
+    }
+  }
+  for (const unsigned w : words)
+    sorted.Convert(d.Convert(w));
+  d = sorted;
+}
+
+// Orders the training sentences by their rarest source word (the largest
+// id after SortVocabularyByFrequency), so that the sentences sharing a rare
+// word are processed one after the other while its row is in cache.
+void Trainer::ClusterByRareWord(const vector<StringPiece>& lines,
+    vector<unsigned>* perm) {
+  vector<unsigned> key(lines.size());
+#pragma omp parallel
+  {
+    vector<unsigned> src, trg;
+#pragma omp for schedule(dynamic, 1024)
+    for (size_t i = 0; i < lines.size(); ++i) {
+      aligner_.ParseLine(lines[i], &src, &trg);
+      if (opts_.reverse)
+        swap(src, trg);
+      key[i] = src.empty() ? 0 : *max_element(src.begin(), src.end());
+    }
+  }
+  perm->resize(lines.size());
+  iota(perm->begin(), perm->end(), 0);
+  stable_sort(perm->begin(), perm->end(),
+      [&key](unsigned a, unsigned b) { return key[a] < key[b]; });
+}
+
+// cross entropy (bits per target word) of the held-out pairs under the
+// current (normalized) model; pairs missing from the table get the same
+// floor as in forced alignment
+double Trainer::DevCrossEntropy(const vector<vector<unsigned>>& src,
+    const vector<vector<unsigned>>& trg, const double n_target_tokens) {
+  const PosteriorFn posterior =
+      SelectPosterior(opts_.use_null, opts_.favor_diagonal, true, true);
+  const PosteriorOptions opts = MakePosteriorOptions(opts_, aligner_.kNULL_);
+  TTable* s2t = &aligner_.s2t_;
+  double likelihood = 0;
+#pragma omp parallel reduction(+:likelihood)
+  {
+    vector<unsigned> viterbi;
+    vector<double> probs;
+#pragma omp for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(src.size()); ++i)
+      likelihood += posterior(src[i], trg[i], 1.0, opts, s2t, &probs, NULL,
+                              &viterbi);
+  }
+  return -likelihood / log(2) / n_target_tokens;
+}
+
+bool Trainer::Train(const vector<StringPiece>& lines,
+    const vector<StringPiece>& dev_lines, const AlignmentSink& sink,
+    string* error) {
+  *error = opts_.Check();
+  if (!error->empty()) return false;
+  ostream& status = Log(opts_);
+  RunStats& stats = *stats_;
+  NumaTopology topology;
+  const bool interleave = aligner_.SetUpNuma();
+  TTable& s2t = aligner_.s2t_;
+  vector<pair<pair<short, short>, unsigned>> size_counts;
+  double n_target_tokens = 0;
+  // cells of the full (unbanded) E-step over all lines and over the
+  // training lines (fewer with dedup)
+  double n_all_cells = 0;
+  double n_training_cells = 0;
+  vector<unsigned> line_order;  // E-step order within each batch
+  // with dedup or reorder, the sentences (with their E-step order and
+  // number of copies) in the order they are trained on; the final
+  // iteration always uses every line in file order
+  vector<StringPiece> training_lines;
+  vector<unsigned> training_order;
+  vector<unsigned> training_weights;
+  CacheMissCounter cache_misses;
+
+  Timer timer;
+
+  if (opts_.reorder) {
+    SortVocabularyByFrequency(lines);
+    stats.phases.Add("reorder", timer.Lap());
+  }
+  vector<unsigned> unique_of;  // with dedup, the unique line of each line
+  if (opts_.dedup) {
+    CollapseDuplicates(lines, &training_lines, &training_weights,
+        &unique_of);
+    status << "distinct sentence pairs: " << training_lines.size() << " of "
+        << lines.size() << endl;
+    stats.corpus.Set("distinct_lines", training_lines.size());
+    stats.phases.Add("dedup", timer.Lap());
+  }
+  const vector<StringPiece>& initial_lines =
+      opts_.dedup ? training_lines : lines;
+  vector<unsigned> training_cost;
+  InitialPass(initial_lines, training_weights, &n_target_tokens, &size_counts, &training_cost);
+  vector<unsigned> line_cost;
+  if (opts_.dedup) {
+    line_cost.resize(unique_of.size());
+    for (size_t i = 0; i < unique_of.size(); ++i)
+      line_cost[i] = training_cost[unique_of[i]];
+  } else {
+    line_cost = training_cost;
+  }
+  const size_t batch_size = max<size_t>(opts_.thread_buffer_size, 1);
+  ScheduleBatches(line_cost, batch_size, &line_order);
+  if (opts_.dedup)
+    ScheduleBatches(training_cost, batch_size, &training_order);
+  n_all_cells = accumulate(line_cost.begin(), line_cost.end(), 0.0);
+  n_training_cells =
+      accumulate(training_cost.begin(), training_cost.end(), 0.0);
+  stats.phases.Add("parse", timer.Lap());
+  if (opts_.reorder) {
+    vector<unsigned> perm;
+    ClusterByRareWord(initial_lines, &perm);
+    vector<StringPiece> clustered(perm.size());
+    vector<unsigned> clustered_cost(perm.size());
+    vector<unsigned> clustered_weights(training_weights.empty() ? 0 : perm.size());
+    for (size_t i = 0; i < perm.size(); ++i) {
+      clustered[i] = initial_lines[perm[i]];
+      clustered_cost[i] = training_cost[perm[i]];
+      if (!clustered_weights.empty())
+        clustered_weights[i] = training_weights[perm[i]];
+    }
+    training_lines.swap(clustered);
+    training_weights.swap(clustered_weights);
+    ScheduleBatches(clustered_cost, batch_size, &training_order);
+    stats.phases.Add("reorder", timer.Lap());
+  }
+  // the rows are written for the first time (and so placed) here
+  if (interleave && !topology.InterleaveAllocations())
+    status << "warning: could not interleave memory over the NUMA nodes\n";
+  s2t.Freeze();
+  if (interleave) topology.LocalAllocations();
+  stats.phases.Add("freeze", timer.Lap());
+  stats.corpus.Set("lines", lines.size());
+  stats.corpus.Set("target_tokens", n_target_tokens);
+  stats.corpus.Set("vocabulary", aligner_.d_.max());
+  stats.corpus.Set("length_pairs", size_counts.size());
+  const RowArena::Stats rs = s2t.allocator_stats();
+  if (rs.allocations) {
+    status << "translation table storage: " << rs.bytes_in_use / 1048576.0
+        << " MB in use, " << rs.bytes_reserved / 1048576.0 << " MB reserved ("
+        << rs.chunks << " chunks, " << rs.large_blocks << " large rows)\n";
+  }
+  if (s2t.num_dense_rows())
+    status << "dense translation table rows: " << s2t.num_dense_rows() << endl;
+  const vector<unsigned> no_weights;
+  // held-out pairs, parsed after the vocabulary is final (reorder): words
+  // only they have get id 0, which has no parameters, instead of growing
+  // the Dict
+  vector<vector<unsigned>> dev_src, dev_trg;
+  double n_dev_tokens = 0;
+  for (const StringPiece& line : dev_lines) {
+    vector<unsigned> s, t;
+    aligner_.ParseLine(line, &s, &t, true);
+    if (opts_.reverse)
+      swap(s, t);
+    if (s.empty() || t.empty()) continue;
+    dev_src.push_back(s);
+    dev_trg.push_back(t);
+    n_dev_tokens += t.size();
+  }
+  if (!dev_lines.empty())
+    stats.corpus.Set("dev_lines", dev_src.size());
+  double last_cross_entropy = 0;  // what tolerance compares against
+
+  int iterations = opts_.iterations;
+  for (int iter = 0; iter < iterations; ++iter) {
+    const bool final_iteration = (iter == (iterations - 1));
+    // nobody wants the alignments, and the final pass doesn't train
+    if (final_iteration && !sink && !opts_.fuse_viterbi) break;
+    const bool decode = final_iteration && sink;
+    status << "ITERATION " << (iter + 1) << (final_iteration ? " (FINAL)" : "") << endl;
+    Timer iter_timer;
+    double estep_seconds = 0;
+    double output_seconds = 0;
+    const double denom = n_target_tokens;
+    int lc = 0;
+    bool flag = false;
+    Batch b;
+    double min_utilization = 1;
+    vector<AlignmentResult> results;
+    const bool use_training_lines = !training_lines.empty() && !final_iteration;
+    const vector<StringPiece>& iter_lines = use_training_lines ? training_lines : lines;
+    const vector<unsigned>& iter_order = use_training_lines ? training_order : line_order;
+    const vector<unsigned>& iter_weights = use_training_lines ? training_weights : no_weights;
+    const uint64_t misses_before = cache_misses.Read();
+    while (lc < static_cast<int>(iter_lines.size())) {
+      const size_t first = lc;
+      const size_t last = min(iter_lines.size(), first + batch_size);
+      while (lc < static_cast<int>(last)) {
+        ++lc;
+        if (lc % 1000 == 0) { status << '.'; flag = true; }
+        if (lc %50000 == 0) { status << " [" << lc << "]\n" << flush; flag = false; }
+      }
+      timer.Lap();
+      const double busy_before = b.busy;
+      const double capacity_before = b.capacity;
+      UpdateFromPairs(iter_lines, iter_order, iter_weights, first, last, lc,
+          final_iteration, decode, &b, &results);
+      estep_seconds += timer.Lap();
+      const double batch_capacity = b.capacity - capacity_before;
+      if (batch_capacity > 0)
+        min_utilization = min(min_utilization, (b.busy - busy_before) / batch_capacity);
+      if (decode) {
+        sink(results);
+        output_seconds += timer.Lap();
+      }
+    } // end data loop
+    const double misses = cache_misses.Read() - misses_before;
+    const double n_tokens = b.tokens;
+    const double n_cells = b.cells;
+    const double likelihood = b.likelihood;
+    StatsRecord it_stats;
+    it_stats.Set("iteration", iter + 1);
+    it_stats.Set("final", final_iteration ? 1 : 0);
+    it_stats.Set("sentences", iter_lines.size());
+    it_stats.Set("tokens", n_tokens);
+    it_stats.Set("cells", n_cells);
+    it_stats.Set("estep_seconds", estep_seconds);
+    it_stats.Set("sentences_per_second", iter_lines.size() / estep_seconds);
+    it_stats.Set("tokens_per_second", n_tokens / estep_seconds);
+    it_stats.Set("cells_per_second", n_cells / estep_seconds);
+    const double utilization = b.capacity > 0 ? b.busy / b.capacity : 1;
+    it_stats.Set("thread_utilization", utilization);
+    it_stats.Set("min_batch_utilization", min_utilization);
+    const bool banded = opts_.favor_diagonal && opts_.band_epsilon > 0;
+    const double iter_cells = use_training_lines ? n_training_cells : n_all_cells;
+    if (banded) {
+      it_stats.Set("band_cell_fraction", n_cells / iter_cells);
+      it_stats.Set("band_dropped_prior", b.dropped_prior);
+    }
+    if (cache_misses.available()) {
+      it_stats.Set("cache_misses", misses);
+      it_stats.Set("cache_misses_per_cell", misses / n_cells);
+    }
+    stats.phases.Add(final_iteration ? "viterbi" : "estep", estep_seconds);
+    if (decode) {
+      it_stats.Set("output_seconds", output_seconds);
+      stats.phases.Add("output", output_seconds);
+    }
+
+    // log(e) = 1.0
+    double base2_likelihood = likelihood / log(2);
+
+    if (flag) {
+      status << endl;
+    }
+    const double emp_feat = b.emp_feat / n_target_tokens;
+    status << "  log_e likelihood: " << likelihood << endl;
+    status << "  log_2 likelihood: " << base2_likelihood << endl;
+    status << "     cross entropy: " << (-base2_likelihood / denom) << endl;
+    status << "        perplexity: " << pow(2.0, -base2_likelihood / denom) << endl;
+    status << "      posterior p0: " << b.c0 / n_target_tokens << endl;
+    status << " posterior al-feat: " << emp_feat << endl;
+    status << "       size counts: " << size_counts.size() << endl;
+    status << "thread utilization: " << utilization << " (worst batch "
+        << min_utilization << ")" << endl;
+    if (banded)
+      status << "  banded E-step: " << n_cells / iter_cells
+          << " of the cells, prior mass left out <= " << b.dropped_prior << endl;
+    if (cache_misses.available())
+      status << "cache misses / cell: " << misses / n_cells << endl;
+    it_stats.Set("log_e_likelihood", likelihood);
+    it_stats.Set("cross_entropy", -base2_likelihood / denom);
+    it_stats.Set("perplexity", pow(2.0, -base2_likelihood / denom));
+    it_stats.Set("posterior_p0", b.c0 / n_target_tokens);
+    it_stats.Set("posterior_al_feat", emp_feat);
+    if (!final_iteration || opts_.fuse_viterbi) {
+      timer.Lap();
+      double& diagonal_tension = opts_.diagonal_tension;
+      if (opts_.favor_diagonal && opts_.optimize_tension && iter > 0) {
+        for (int ii = 0; ii < 8; ++ii) {
+          double mod_feat = 0;
+#pragma omp parallel for reduction(+:mod_feat)
+          for(size_t i = 0; i < size_counts.size(); ++i) {
+            const pair<short,short>& p = size_counts[i].first;
+            for (short j = 1; j <= p.first; ++j)
+              mod_feat += size_counts[i].second * DiagonalAlignment::ComputeDLogZ(j, p.first, p.second, diagonal_tension);
+          }
+          mod_feat /= n_target_tokens;
+          status << "  " << ii + 1 << "  model al-feat: " << mod_feat << " (tension=" << diagonal_tension << ")\n";
+          diagonal_tension += (emp_feat - mod_feat) * 20.0;
+          if (diagonal_tension <= 0.1) diagonal_tension = 0.1;
+          if (diagonal_tension > 14) diagonal_tension = 14;
+        }
+        status << "     final tension: " << diagonal_tension << endl;
+        const double tension_seconds = timer.Lap();
+        it_stats.Set("tension_seconds", tension_seconds);
+        stats.phases.Add("tension", tension_seconds);
+      }
+      it_stats.Set("diagonal_tension", diagonal_tension);
+      if (opts_.variational_bayes)
+        s2t.NormalizeVB(opts_.alpha);
+      else
+        s2t.Normalize();
+      const double normalize_seconds = timer.Lap();
+      it_stats.Set("normalize_seconds", normalize_seconds);
+      stats.phases.Add("normalize", normalize_seconds);
+      // the training cross entropy above is that of the previous model, the
+      // held-out one that of the model just estimated
+      double cross_entropy = -base2_likelihood / denom;
+      if (!dev_src.empty()) {
+        cross_entropy = DevCrossEntropy(dev_src, dev_trg, n_dev_tokens);
+        const double dev_seconds = timer.Lap();
+        status << " dev cross entropy: " << cross_entropy << endl;
+        it_stats.Set("dev_cross_entropy", cross_entropy);
+        stats.phases.Add("dev", dev_seconds);
+      }
+      if (opts_.tolerance > 0 && !final_iteration && iter > 0) {
+        const double improvement =
+            (last_cross_entropy - cross_entropy) / last_cross_entropy;
+        it_stats.Set("improvement", improvement);
+        if (improvement < opts_.tolerance && iter + 2 < iterations) {
+          status << "         converged: improvement " << improvement
+              << " < " << opts_.tolerance << ", final pass next" << endl;
+          iterations = iter + 2;
+          stats.params.Set("stopped_after", iter + 1);
+        }
+      }
+      last_cross_entropy = cross_entropy;
+    }
+    it_stats.Set("seconds", iter_timer.Elapsed());
+    stats.iterations.push_back(it_stats);
+  }
+  opts_.iterations = iterations;  // fewer if training converged
+  return true;
+}
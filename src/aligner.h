@@ -0,0 +1,227 @@
+#ifndef ALIGNER_H_
+#define ALIGNER_H_
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "src/alignment_io.h"
+#include "src/compact_ttable.h"
+#include "src/corpus.h"
+#include "src/run_stats.h"
+#include "src/ttables.h"
+
+// The fast_align model and its training, as a library (libfast_align): the
+// fast_align program is a command line wrapper around Trainer and Aligner.
+//
+//   AlignerOptions opts;
+//   opts.favor_diagonal = true;
+//   Trainer trainer(opts, NULL);
+//   trainer.Train(corpus_lines, dev_lines, sink);   // "src ||| trg" lines
+//   trainer.aligner().SaveModel("fwd.params");
+//
+//   Aligner aligner(opts);
+//   aligner.LoadModel("fwd.params");
+//   aligner.AlignBatch(pairs, &results);              // word ids, no text
+//
+// Sentence pairs are always given in the orientation of the corpus
+// (source ||| target); with reverse, the model predicts the source words
+// from the target words and the pairs are swapped internally.
+
+struct AlignerOptions {
+  AlignerOptions()
+      : reverse(false), iterations(5), favor_diagonal(false),
+        prob_align_null(0.08), diagonal_tension(4.0),
+        optimize_tension(false), variational_bayes(false), alpha(0.01),
+        use_null(true), mean_srclen_multiplier(1.0), beam_threshold(-4.0),
+        thread_buffer_size(10000), band_epsilon(0), dedup(false),
+        fuse_viterbi(false), tolerance(0), reorder(false),
+        sketch_min_count(0), sketch_epsilon(1e-6), sketch_delta(0.01),
+        numa("off"), log(&std::cerr) {}
+  bool reverse;
+  int iterations;           // including the final (decoding) pass
+  bool favor_diagonal;
+  double prob_align_null;
+  double diagonal_tension;  // the starting value when it is optimized
+  bool optimize_tension;
+  bool variational_bayes;
+  double alpha;
+  bool use_null;
+  // expected target length / source length; learned by training
+  double mean_srclen_multiplier;
+  double beam_threshold;    // SaveModel leaves out smaller log probs
+  size_t thread_buffer_size;
+  double band_epsilon;
+  bool dedup;
+  bool fuse_viterbi;
+  double tolerance;
+  bool reorder;
+  // pairs co-occurring fewer times share a count-min sketch with width
+  // e / sketch_epsilon and depth ln(1 / sketch_delta) (0: every pair
+  // gets an entry)
+  unsigned sketch_min_count;
+  double sketch_epsilon;
+  double sketch_delta;
+  std::string numa;         // off, interleave or firsttouch
+  std::ostream* log;        // progress messages; NULL for none
+
+  // returns an error message, or an empty string if the options are valid
+  std::string Check() const;
+};
+
+// a sentence as word ids of the aligner's vocabulary, not owned
+struct WordSpan {
+  WordSpan() : words(NULL), size(0) {}
+  WordSpan(const unsigned* w, size_t n) : words(w), size(n) {}
+  explicit WordSpan(const std::vector<unsigned>& v)
+      : words(v.empty() ? NULL : &v[0]), size(v.size()) {}
+  const unsigned* words;
+  size_t size;
+};
+
+struct SentencePair {
+  SentencePair() {}
+  SentencePair(const WordSpan& s, const WordSpan& t) : src(s), trg(t) {}
+  WordSpan src;
+  WordSpan trg;
+};
+
+// the best alignment of one sentence pair
+struct AlignmentResult {
+  AlignmentResult() : src_size(), trg_size(), log_prob() {}
+  unsigned src_size;
+  unsigned trg_size;
+  // (source, target) positions, 0-based, of the links of the words the
+  // model predicts that aren't aligned to NULL, in the order of those words
+  std::vector<Alignment::Link> links;
+  double log_prob;  // log p(target | source), with the length model
+};
+
+// gets the final alignments of a batch of corpus lines, in corpus order
+typedef std::function<void(const std::vector<AlignmentResult>&)> AlignmentSink;
+
+class Trainer;
+
+// A trained model: the vocabulary, the translation table and the learned
+// hyperparameters (tension and length ratio, in options()).
+class Aligner {
+ public:
+  explicit Aligner(const AlignerOptions& opts);
+
+  const AlignerOptions& options() const { return opts_; }
+  Dict& dict() { return d_; }
+  const Dict& dict() const { return d_; }
+  const TTable& ttable() const { return s2t_; }
+  unsigned null_word() const { return kNULL_; }
+  unsigned separator() const { return kDIV_; }
+
+  // reads / writes the translation table in the text format of
+  // fast_align -p; false if the file can't be opened. LoadModel also reads
+  // compact models (see SaveCompactModel).
+  bool LoadModel(const std::string& filename);
+  bool SaveModel(const std::string& filename) const;
+  // writes the parameters SaveModel would write, with the vocabulary, as a
+  // CompactTTable with bits (8 or 16) per log probability. Loading it maps
+  // the file instead of building the table, and the aligner can then only
+  // align. Neither Save works on a compact model.
+  bool SaveCompactModel(const std::string& filename, int bits) const;
+  bool compact() const { return !compact_.empty(); }
+
+  // splits a "source ||| target" line into word ids, adding new words
+  // (or, with frozen, giving them id 0)
+  void ParseLine(const StringPiece& line, std::vector<unsigned>* src,
+                 std::vector<unsigned>* trg, bool frozen = false);
+  void ParseLine(const std::string& line, std::vector<unsigned>* src,
+                 std::vector<unsigned>* trg, bool frozen = false) {
+    ParseLine(StringPiece(line), src, trg, frozen);
+  }
+
+  // id of the words the model doesn't have; the table has no entries for
+  // it, so they get the floor probability of safe_prob
+  static const unsigned kUnknownWord = 0;
+
+  // like ParseLine, but with the vocabulary frozen: unknown words get
+  // kUnknownWord, so the vocabulary stays the size of the model however
+  // much text is aligned, and any number of threads may parse at once. If
+  // src_words and trg_words aren't NULL, they get the words themselves
+  // (pointing into line), e.g. to echo them.
+  void LookUpLine(const StringPiece& line, std::vector<unsigned>* src,
+                  std::vector<unsigned>* trg,
+                  std::vector<StringPiece>* src_words,
+                  std::vector<StringPiece>* trg_words) const;
+  // the ids of a sentence of whitespace separated words, as LookUpLine
+  void LookUpWords(const StringPiece& sentence,
+                   std::vector<unsigned>* ids) const;
+
+  // aligns the pairs in parallel; words missing from the model (e.g.
+  // kUnknownWord) get the same floor probability as unseen pairs. Pairs
+  // with an empty side get no links and a log_prob of 0.
+  void AlignBatch(const std::vector<SentencePair>& pairs,
+                  std::vector<AlignmentResult>* results) const;
+
+  // the size of the model, for --stats_file
+  void CollectModelStats(StatsRecord* model) const;
+
+ private:
+  friend class Trainer;
+  Aligner(const Aligner&);
+  void operator=(const Aligner&);
+  // pins the threads and returns true if the table is to be interleaved
+  bool SetUpNuma() const;
+
+  AlignerOptions opts_;
+  Dict d_;
+  unsigned kNULL_;
+  unsigned kDIV_;
+  TTable s2t_;
+  CompactTTable compact_;  // when loaded from a compact model
+};
+
+// EM training of an Aligner on a corpus of "source ||| target" lines
+class Trainer {
+ public:
+  // stats may be NULL
+  Trainer(const AlignerOptions& opts, RunStats* stats);
+
+  Aligner& aligner() { return aligner_; }
+
+  // trains for options().iterations passes (fewer with tolerance), the
+  // last of which decodes the alignment of every line and passes them to
+  // sink in batches. Without a sink, the decoding pass is skipped (unless
+  // it also trains, with fuse_viterbi). dev_lines may be empty. Returns
+  // false with *error set if training can't start.
+  bool Train(const std::vector<StringPiece>& lines,
+             const std::vector<StringPiece>& dev_lines,
+             const AlignmentSink& sink, std::string* error);
+
+ private:
+  Trainer(const Trainer&);
+  void operator=(const Trainer&);
+  struct Batch;
+  void InitialPass(const std::vector<StringPiece>& lines,
+                   const std::vector<unsigned>& weights,
+                   double* n_target_tokens,
+                   std::vector<std::pair<std::pair<short, short>, unsigned> >*
+                       size_counts,
+                   std::vector<unsigned>* line_cost);
+  void SortVocabularyByFrequency(const std::vector<StringPiece>& lines);
+  void ClusterByRareWord(const std::vector<StringPiece>& lines,
+                         std::vector<unsigned>* perm);
+  void UpdateFromPairs(const std::vector<StringPiece>& lines,
+                       const std::vector<unsigned>& order,
+                       const std::vector<unsigned>& weights, size_t first,
+                       size_t last, int lc, bool final_iteration,
+                       bool decode, Batch* b,
+                       std::vector<AlignmentResult>* results);
+  double DevCrossEntropy(const std::vector<std::vector<unsigned> >& src,
+                         const std::vector<std::vector<unsigned> >& trg,
+                         double n_target_tokens);
+
+  Aligner aligner_;
+  AlignerOptions& opts_;
+  RunStats own_stats_;
+  RunStats* stats_;
+};
+
+#endif
@@ -1,65 +1,101 @@
 #include "src/alignment_io.h"
 
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <stddef.h>
+
 using namespace std;
 
 static bool is_digit(char x) { return x >= '0' && x <= '9'; }
 
-std::shared_ptr<Array2D<bool> > AlignmentIO::ReadPharaohAlignmentGrid(const string& al) {
-  int max_x = 0;
-  int max_y = 0;
+// writes the decimal digits of x to buf, returns their number
+static size_t FormatUnsigned(unsigned x, char* buf) {
+  char tmp[10];
+  size_t n = 0;
+  do {
+    tmp[n++] = '0' + x % 10;
+    x /= 10;
+  } while (x);
+  for (size_t k = 0; k < n; ++k) buf[k] = tmp[n - 1 - k];
+  return n;
+}
+
+void Alignment::ToGrid(Array2D<bool>* grid) const {
+  grid->clear();
+  grid->resize(width, height);
+  for (const Link& l : links)
+    (*grid)(l.first, l.second) = true;
+}
+
+void AlignmentIO::ReadPharaohAlignment(const string& al, Alignment* a) {
+  unsigned max_x = 0;
+  unsigned max_y = 0;
+  a->links.clear();
+  bool sorted = true;
   unsigned i = 0;
   size_t pos = al.rfind(" ||| ");
   if (pos != string::npos) { i = pos + 5; }
   while (i < al.size()) {
     if (al[i] == '\n' || al[i] == '\r') break;
-    int x = 0;
+    unsigned x = 0;
     while(i < al.size() && is_digit(al[i])) {
       x *= 10;
       x += al[i] - '0';
       ++i;
     }
     if (x > max_x) max_x = x;
-    assert(i < al.size());
-    if(al[i] != '-') {
+    if(i >= al.size() || al[i] != '-') {
       cerr << "BAD ALIGNMENT: " << al << endl;
       abort();
     }
     ++i;
-    int y = 0;
+    unsigned y = 0;
     while(i < al.size() && is_digit(al[i])) {
       y *= 10;
       y += al[i] - '0';
       ++i;
     }
     if (y > max_y) max_y = y;
+    const Alignment::Link link(x, y);
+    if (sorted && !a->links.empty() && !(a->links.back() < link)) sorted = false;
+    a->links.push_back(link);
     while(i < al.size() && al[i] == ' ') { ++i; }
   }
+  if (!sorted) {
+    // e.g. forward fast_align output, which is in target order
+    sort(a->links.begin(), a->links.end());
+    a->links.erase(unique(a->links.begin(), a->links.end()), a->links.end());
+  }
+  a->width = max_x + 1;
+  a->height = max_y + 1;
+}
 
-  std::shared_ptr<Array2D<bool> > grid(new Array2D<bool>(max_x + 1, max_y + 1));
-  i = 0;
-  if (pos != string::npos) { i = pos + 5; }
-  while (i < al.size()) {
-    if (al[i] == '\n' || al[i] == '\r') break;
-    int x = 0;
-    while(i < al.size() && is_digit(al[i])) {
-      x *= 10;
-      x += al[i] - '0';
-      ++i;
-    }
-    assert(i < al.size());
-    assert(al[i] == '-');
-    ++i;
-    int y = 0;
-    while(i < al.size() && is_digit(al[i])) {
-      y *= 10;
-      y += al[i] - '0';
-      ++i;
+std::shared_ptr<Array2D<bool> > AlignmentIO::ReadPharaohAlignmentGrid(const string& al) {
+  Alignment a;
+  ReadPharaohAlignment(al, &a);
+  std::shared_ptr<Array2D<bool> > grid(new Array2D<bool>);
+  a.ToGrid(grid.get());
+  return grid;
+}
+
+void AlignmentIO::SerializePharaohFormat(const Alignment& alignment, ostream* out) {
+  // formatted by hand into one buffer, which is much faster than operator<<
+  char buf[4096];
+  size_t n = 0;
+  for (size_t k = 0; k < alignment.links.size(); ++k) {
+    if (n > sizeof(buf) - 32) {
+      out->write(buf, n);
+      n = 0;
     }
-    (*grid)(x, y) = true;
-    while(i < al.size() && al[i] == ' ') { ++i; }
+    if (k) buf[n++] = ' ';
+    n += FormatUnsigned(alignment.links[k].first, buf + n);
+    buf[n++] = '-';
+    n += FormatUnsigned(alignment.links[k].second, buf + n);
   }
-  // cerr << *grid << endl;
-  return grid;
+  buf[n++] = '\n';
+  out->write(buf, n);
 }
 
 void AlignmentIO::SerializePharaohFormat(const Array2D<bool>& alignment, ostream* o) {
@@ -95,3 +131,197 @@ void AlignmentIO::SerializeTypedAlignment(const Array2D<AlignmentType>& alignmen
   out << endl;
 }
 
+const char BinaryAlignmentFormat::kMagic[9] = "\x89" "FALIGN\n";
+const char BinaryAlignmentFormat::kIndexMagic[9] = "\x89" "FAIDX1\n";
+
+static void PutVarint(uint64_t x, string* out) {
+  while (x >= 0x80) {
+    out->push_back(static_cast<char>(x | 0x80));
+    x >>= 7;
+  }
+  out->push_back(static_cast<char>(x));
+}
+
+// reads a varint from [*p, end); returns false if it is cut short
+static bool GetVarint(const char** p, const char* end, uint64_t* x) {
+  *x = 0;
+  for (unsigned shift = 0; *p < end && shift < 64; shift += 7) {
+    const unsigned char b = *(*p)++;
+    *x |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+static bool ReadVarint(istream* in, uint64_t* x) {
+  *x = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    const int b = in->get();
+    if (b == EOF) return false;
+    *x |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+static void PutUint64(uint64_t x, ostream* out) {
+  out->write(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+static bool GetUint64(istream* in, uint64_t* x) {
+  return static_cast<bool>(in->read(reinterpret_cast<char*>(x), sizeof(*x)));
+}
+
+void BinaryAlignmentFormat::Encode(const Alignment& a, bool has_score,
+    double score, string* record) {
+  string payload;
+  payload.reserve(8 + 2 * a.links.size() + 8);
+  PutVarint(a.width, &payload);
+  PutVarint(a.height, &payload);
+  PutVarint(a.links.size(), &payload);
+  unsigned prev_i = 0;
+  unsigned next_j = 0;  // smallest j possible for the same i
+  for (const Alignment::Link& l : a.links) {
+    PutVarint(l.first - prev_i, &payload);
+    PutVarint(l.first == prev_i ? l.second - next_j : l.second, &payload);
+    prev_i = l.first;
+    next_j = l.second + 1;
+  }
+  if (has_score)
+    payload.append(reinterpret_cast<const char*>(&score), sizeof(score));
+  record->clear();
+  PutVarint(payload.size(), record);
+  record->append(payload);
+}
+
+bool BinaryAlignmentFormat::Decode(const string& payload, bool has_score,
+    Alignment* a, double* score) {
+  const char* p = payload.data();
+  const char* end = p + payload.size();
+  uint64_t width, height, n;
+  if (!GetVarint(&p, end, &width) || !GetVarint(&p, end, &height) ||
+      !GetVarint(&p, end, &n))
+    return false;
+  // every link takes at least two bytes
+  if (width > UINT_MAX || height > UINT_MAX ||
+      n > static_cast<uint64_t>(end - p) / 2)
+    return false;
+  a->width = width;
+  a->height = height;
+  a->links.resize(n);
+  uint64_t prev_i = 0;
+  uint64_t next_j = 0;
+  for (uint64_t k = 0; k < n; ++k) {
+    uint64_t di, j;
+    if (!GetVarint(&p, end, &di) || !GetVarint(&p, end, &j)) return false;
+    // links outside the sentences would index past the end of the grids
+    // that atools builds from them
+    if (di >= width - prev_i) return false;
+    const uint64_t i = prev_i + di;
+    if (!di) {
+      if (j >= height - next_j) return false;
+      j += next_j;
+    } else if (j >= height) {
+      return false;
+    }
+    a->links[k] = Alignment::Link(i, j);
+    prev_i = i;
+    next_j = j + 1;
+  }
+  if (has_score) {
+    if (end - p < static_cast<ptrdiff_t>(sizeof(*score))) return false;
+    memcpy(score, p, sizeof(*score));
+    p += sizeof(*score);
+  }
+  return p == end;
+}
+
+BinaryAlignmentWriter::BinaryAlignmentWriter(ostream* out, ostream* index,
+    bool has_scores)
+    : out_(out), index_(index), has_scores_(has_scores), offset_(),
+      records_() {
+  string header(BinaryAlignmentFormat::kMagic, 8);
+  PutVarint(has_scores ? BinaryAlignmentFormat::kScores : 0, &header);
+  out_->write(header.data(), header.size());
+  offset_ = header.size();
+  if (index_) {
+    index_->write(BinaryAlignmentFormat::kIndexMagic, 8);
+    PutUint64(BinaryAlignmentFormat::kIndexStride, index_);
+  }
+}
+
+void BinaryAlignmentWriter::Write(const Alignment& a, double score) {
+  BinaryAlignmentFormat::Encode(a, has_scores_, score, &buf_);
+  WriteEncoded(buf_);
+}
+
+void BinaryAlignmentWriter::WriteEncoded(const string& record) {
+  if (index_ && records_ % BinaryAlignmentFormat::kIndexStride == 0)
+    PutUint64(offset_, index_);
+  out_->write(record.data(), record.size());
+  offset_ += record.size();
+  ++records_;
+}
+
+void BinaryAlignmentWriter::Close() {
+  if (index_) {
+    PutUint64(records_, index_);
+    index_->flush();
+    index_ = NULL;
+  }
+  out_->flush();
+}
+
+BinaryAlignmentReader::BinaryAlignmentReader(istream* in)
+    : in_(in), ok_(false), has_scores_(false) {
+  char magic[8];
+  if (!in_->read(magic, 8) ||
+      memcmp(magic, BinaryAlignmentFormat::kMagic, 8) != 0)
+    return;
+  uint64_t flags;
+  if (!ReadVarint(in_, &flags)) return;
+  has_scores_ = flags & BinaryAlignmentFormat::kScores;
+  ok_ = true;
+}
+
+bool BinaryAlignmentReader::ReadRecord(string* payload) {
+  uint64_t size;
+  if (!ok_ || !ReadVarint(in_, &size)) return false;
+  payload->resize(size);
+  if (size && !in_->read(&(*payload)[0], size)) {
+    cerr << "Truncated binary alignment record\n";
+    abort();
+  }
+  return true;
+}
+
+bool BinaryAlignmentReader::Read(Alignment* a, double* score) {
+  if (!ReadRecord(&payload_)) return false;
+  if (!BinaryAlignmentFormat::Decode(payload_, has_scores_, a, score)) {
+    cerr << "Malformed binary alignment record\n";
+    abort();
+  }
+  return true;
+}
+
+bool BinaryAlignmentReader::Seek(istream* index, uint64_t n) {
+  char magic[8];
+  uint64_t stride, offset;
+  uint64_t records;
+  if (!ok_ || !index->seekg(0) || !index->read(magic, 8) ||
+      memcmp(magic, BinaryAlignmentFormat::kIndexMagic, 8) != 0 ||
+      !GetUint64(index, &stride) || !stride ||
+      !index->seekg(-8, ios_base::end) || !GetUint64(index, &records) ||
+      n >= records)
+    return false;
+  if (!index->seekg(8 + 8 * (1 + n / stride)) || !GetUint64(index, &offset))
+    return false;
+  in_->clear();
+  if (!in_->seekg(offset)) return false;
+  for (uint64_t k = 0; k < n % stride; ++k) {
+    uint64_t size;
+    if (!ReadVarint(in_, &size) || !in_->seekg(size, ios_base::cur))
+      return false;
+  }
+  return true;
+}
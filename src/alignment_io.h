@@ -4,16 +4,114 @@
 #include <string>
 #include <iostream>
 #include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
 #include "array2d.h"
 
+// Word alignment of one sentence pair as a list of links (i, j), sorted and
+// without duplicates, plus the size of the grid they are in: one more than
+// the largest i and j read, as for ReadPharaohAlignmentGrid (so an empty
+// alignment is 1 x 1). Reading into the same object again reuses its
+// memory.
+struct Alignment {
+  typedef std::pair<unsigned, unsigned> Link;
+  Alignment() : width(), height() {}
+  void ToGrid(Array2D<bool>* grid) const;
+
+  unsigned width;
+  unsigned height;
+  std::vector<Link> links;
+};
+
 struct AlignmentIO {
   enum AlignmentType { kNONE = 0, kTRANSLATION = 1, kTRANSLITERATION = 2 };
 
   static std::shared_ptr<Array2D<bool> > ReadPharaohAlignmentGrid(const std::string& al);
+  // parses the line in one pass; aborts on malformed input like
+  // ReadPharaohAlignmentGrid
+  static void ReadPharaohAlignment(const std::string& al, Alignment* a);
   static void SerializePharaohFormat(const Array2D<bool>& alignment, std::ostream* out);
+  static void SerializePharaohFormat(const Alignment& alignment, std::ostream* out);
   static void SerializeTypedAlignment(const Array2D<AlignmentType>& alignment, std::ostream* out);
 };
 
+// Binary alignment stream, a compact alternative to Pharaoh text for
+// passing alignments between fast_align and atools:
+//   header   8 magic bytes ("\x89FALIGN\n"), varint flags (1 = scores)
+//   record   varint payload size, then the payload:
+//            varint width, varint height (the sentence lengths), varint
+//            number of links, and per link (sorted by i, then j) the varints
+//            i - previous i and j (or j - previous j - 1 if i is the same),
+//            then, with scores, the score as 8 bytes (IEEE double, host
+//            byte order)
+// The first byte of the magic can't start a Pharaoh line, so readers tell
+// the formats apart by peeking at one byte. A writer given an index stream
+// writes to it the offset of every kIndexStride-th record, so that
+// BinaryAlignmentReader::Seek jumps to a sentence without decoding the file:
+//   index    8 magic bytes ("\x89FAIDX1\n"), uint64 stride, then uint64
+//            offsets of records 0, stride, 2 stride, ..., and finally the
+//            uint64 number of records
+struct BinaryAlignmentFormat {
+  static const char kMagic[9];
+  static const char kIndexMagic[9];
+  static const unsigned kScores = 1;
+  static const uint64_t kIndexStride = 1024;
+
+  static bool IsBinary(std::istream* in) {
+    return in->peek() == static_cast<unsigned char>(kMagic[0]);
+  }
+  // encodes a record (including its size prefix); a must be sorted
+  static void Encode(const Alignment& a, bool has_score, double score,
+                     std::string* record);
+  // decodes a record payload (without the size prefix); returns false if it
+  // is malformed
+  static bool Decode(const std::string& payload, bool has_score,
+                     Alignment* a, double* score);
+};
+
+class BinaryAlignmentWriter {
+ public:
+  // index may be NULL
+  BinaryAlignmentWriter(std::ostream* out, std::ostream* index,
+                        bool has_scores);
+  ~BinaryAlignmentWriter() { Close(); }
+  bool has_scores() const { return has_scores_; }
+  void Write(const Alignment& a, double score);
+  // writes a record made by BinaryAlignmentFormat::Encode
+  void WriteEncoded(const std::string& record);
+  // finishes the index; called by the destructor
+  void Close();
+
+ private:
+  std::ostream* out_;
+  std::ostream* index_;
+  bool has_scores_;
+  uint64_t offset_;
+  uint64_t records_;
+  std::string buf_;
+};
+
+class BinaryAlignmentReader {
+ public:
+  // reads the header; ok() is false if in isn't a binary alignment stream
+  explicit BinaryAlignmentReader(std::istream* in);
+  bool ok() const { return ok_; }
+  bool has_scores() const { return has_scores_; }
+  // reads the payload of the next record; false at the end of the stream
+  bool ReadRecord(std::string* payload);
+  bool Read(Alignment* a, double* score);
+  // positions the reader at record n (0-based) with the help of the index
+  // written next to the stream; in must be seekable
+  bool Seek(std::istream* index, uint64_t n);
+
+ private:
+  std::istream* in_;
+  bool ok_;
+  bool has_scores_;
+  std::string payload_;
+};
+
 inline std::ostream& operator<<(std::ostream& os, const Array2D<AlignmentIO::AlignmentType>& m) {
   os << ' ';
   for (unsigned j=0; j<m.height(); ++j)
@@ -0,0 +1,150 @@
+// Checks the binary alignment format (alignment_io.h): records written by
+// BinaryAlignmentWriter read back the same, BinaryAlignmentReader::Seek
+// finds every record through the index, and Decode rejects malformed
+// records (links outside the sentence, impossible sizes and counts,
+// truncated or overlong payloads) instead of returning them.
+//
+//   alignment_io_test    exit status 1 on a failure
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/alignment_io.h"
+
+using namespace std;
+
+unsigned failures = 0;
+
+void Expect(bool ok, const string& what) {
+  cout << what << ": " << (ok ? "ok" : "FAILED") << endl;
+  if (!ok) ++failures;
+}
+
+bool Same(const Alignment& a, const Alignment& b) {
+  return a.width == b.width && a.height == b.height && a.links == b.links;
+}
+
+// a sorted alignment of random sentence lengths, some of them empty
+Alignment RandomAlignment() {
+  Alignment a;
+  a.width = rand() % 60;
+  a.height = rand() % 60;
+  if (a.width && a.height) {
+    for (unsigned i = 0; i < a.width; ++i)
+      for (unsigned j = 0; j < a.height; ++j)
+        if (rand() % 20 == 0) a.links.push_back(Alignment::Link(i, j));
+  }
+  return a;
+}
+
+void PutVarint(uint64_t x, string* out) {
+  while (x >= 128) {
+    out->push_back(static_cast<char>(x | 128));
+    x >>= 7;
+  }
+  out->push_back(static_cast<char>(x));
+}
+
+// the payload of Encode(a), without its size prefix
+string Payload(const Alignment& a) {
+  string record;
+  BinaryAlignmentFormat::Encode(a, false, 0, &record);
+  size_t k = 0;
+  while (static_cast<unsigned char>(record[k]) & 128) ++k;
+  return record.substr(k + 1);
+}
+
+bool Rejects(const string& payload, bool has_score = false) {
+  Alignment a;
+  double score;
+  return !BinaryAlignmentFormat::Decode(payload, has_score, &a, &score);
+}
+
+int main() {
+  srand(1);
+  // more records than one stride of the index
+  const unsigned n = 2 * BinaryAlignmentFormat::kIndexStride + 300;
+  vector<Alignment> als(n);
+  vector<double> scores(n);
+  ostringstream out, index;
+  {
+    BinaryAlignmentWriter writer(&out, &index, true);
+    for (unsigned k = 0; k < n; ++k) {
+      als[k] = RandomAlignment();
+      scores[k] = -0.25 * k;
+      writer.Write(als[k], scores[k]);
+    }
+  }
+  const string bytes = out.str();
+
+  {
+    istringstream in(bytes);
+    Expect(BinaryAlignmentFormat::IsBinary(&in), "binary_magic");
+    BinaryAlignmentReader reader(&in);
+    bool same = reader.ok() && reader.has_scores();
+    Alignment a;
+    double score;
+    unsigned k = 0;
+    for (; same && reader.Read(&a, &score); ++k)
+      same = k < n && Same(a, als[k]) && score == scores[k];
+    Expect(same && k == n, "binary_round_trip");
+  }
+
+  {
+    istringstream in(bytes), idx(index.str());
+    BinaryAlignmentReader reader(&in);
+    const unsigned stride = BinaryAlignmentFormat::kIndexStride;
+    const unsigned targets[] = { n - 1, 0, stride - 1, stride, stride + 1,
+                                 2 * stride + 17, 5 };
+    bool same = true;
+    for (unsigned t : targets) {
+      Alignment a;
+      double score;
+      same = same && reader.Seek(&idx, t) && reader.Read(&a, &score) &&
+          Same(a, als[t]) && score == scores[t];
+    }
+    Expect(same, "binary_seek");
+    Expect(!reader.Seek(&idx, n), "binary_seek_past_end");
+    istringstream bad_idx("not an index");
+    Expect(!reader.Seek(&bad_idx, 0), "binary_seek_bad_index");
+  }
+
+  Alignment a;
+  a.width = 2;
+  a.height = 3;
+  a.links.push_back(Alignment::Link(0, 1));
+  a.links.push_back(Alignment::Link(1, 2));
+  const string good = Payload(a);
+  Expect(!Rejects(good), "binary_decode");
+
+  // links outside the sentence, which atools would index its grids with
+  Alignment outside = a;
+  outside.links[1] = Alignment::Link(5, 1);
+  Alignment below = a;
+  below.links[1] = Alignment::Link(1, 7);
+  Alignment same_row = a;
+  same_row.links[1] = Alignment::Link(0, 3);
+  Expect(Rejects(Payload(outside)) && Rejects(Payload(below)) &&
+         Rejects(Payload(same_row)), "binary_reject_links_outside");
+
+  // sizes that don't fit an unsigned, and more links than the bytes left
+  string wide, many;
+  PutVarint(uint64_t(1) << 40, &wide);
+  PutVarint(3, &wide);
+  PutVarint(0, &wide);
+  PutVarint(2, &many);
+  PutVarint(3, &many);
+  PutVarint(uint64_t(1) << 40, &many);
+  many += string(8, '\0');
+  Expect(Rejects(wide) && Rejects(many), "binary_reject_sizes");
+
+  bool truncated = true;
+  for (size_t k = 0; k < good.size(); ++k)
+    truncated = truncated && Rejects(good.substr(0, k));
+  Expect(truncated && Rejects(good + 'x') && Rejects(good, true),
+         "binary_reject_truncated");
+  return failures ? 1 : 0;
+}
@@ -6,297 +6,240 @@
 #include <queue>
 #include <map>
 #include <set>
+#include <functional>
 #include <getopt.h>
+#include <poll.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-#include "alignment_io.h"
+#include "src/atools_commands.h"
 
 using namespace std;
 
 struct option options[] = {
     {"input_1",                 required_argument, 0,                  'i'},
     {"input_2",                 required_argument, 0,                  'j'},
+    {"input",                   required_argument, 0,                  'n'},
     {"command",                 required_argument, 0,                  'c'},
+    {"tee",                     required_argument, 0,                  'T'},
+    {"threads",                 required_argument, 0,                  't'},
+    {"batch_size",              required_argument, 0,                  'b'},
+    {"output",                  required_argument, 0,                  'o'},
+    {"binary",                  no_argument,       0,                  'B'},
     {0,0,0,0}
 };
 
 string input_1;
 string input_2;
-string command;
+// NAME=FILE, in command line order; -i and -j are the inputs i and j
+vector<pair<string, string> > named_inputs;
+// stages of the pipeline, [NAME=]COMMAND[(OPERAND[,OPERAND])]
+vector<string> stage_specs;
+// NAME=FILE: writes the output of stage NAME to FILE as well
+vector<pair<string, string> > tees;
+int num_threads = 0;
+size_t batch_size = 10000;
+string output;
+bool binary_output = false;
+
+// splits NAME=VALUE; false if there is no '=' or either side is empty
+static bool SplitAssignment(const string& s, pair<string, string>* nv) {
+  const size_t eq = s.find('=');
+  if (eq == string::npos || eq == 0 || eq + 1 == s.size()) return false;
+  nv->first = s.substr(0, eq);
+  nv->second = s.substr(eq + 1);
+  return true;
+}
 
 bool InitCommandLine(int argc, char** argv) {
+  pair<string, string> nv;
   while (1) {
     int oi;
-    int c = getopt_long(argc, argv, "i:j:c:", options, &oi);
+    int c = getopt_long(argc, argv, "i:j:n:c:T:t:b:o:B", options, &oi);
     if (c == -1) break;
     switch(c) {
       case 'i': input_1 = optarg; break;
       case 'j': input_2 = optarg; break;
-      case 'c': command = optarg; break;
+      case 'n':
+        if (!SplitAssignment(optarg, &nv)) return false;
+        named_inputs.push_back(nv);
+        break;
+      case 'c': stage_specs.push_back(optarg); break;
+      case 'T':
+        if (!SplitAssignment(optarg, &nv)) return false;
+        tees.push_back(nv);
+        break;
+      case 't': num_threads = atoi(optarg); break;
+      case 'b': batch_size = max(atoi(optarg), 1); break;
+      case 'o': output = optarg; break;
+      case 'B': binary_output = true; break;
       default: return false;
     }
   }
-  if (input_1.size() == 0) return false;
-  if (command.size() == 0) return false;
+  if (input_1.empty() && named_inputs.empty()) return false;
+  if (stage_specs.empty()) return false;
   return true;
 }
 
-struct Command {
-  virtual ~Command() {}
-  virtual string Name() const = 0;
+map<string, shared_ptr<Command> > commands;
+// makes a new instance of each command, one per thread and stage
+map<string, function<Command*()> > factories;
 
-  // returns 1 for alignment grid output [default]
-  // returns 2 if Summary() should be called [for AER, etc]
-  virtual int Result() const { return 1; }
+template<class C> static void AddCommand() {
+  C* c = new C;
+  commands[c->Name()].reset(c);
+  factories[c->Name()] = []() -> Command* { return new C; };
+}
 
-  virtual bool RequiresTwoOperands() const { return true; }
-  virtual void Apply(const Array2D<bool>& a, const Array2D<bool>& b, Array2D<bool>* x) = 0;
-  void EnsureSize(const Array2D<bool>& a, const Array2D<bool>& b, Array2D<bool>* x) {
-    x->resize(max(a.width(), b.width()), max(a.height(), b.height()));
+// one input file, in Pharaoh text or binary format (told apart by the
+// first byte); Next reads a line or the payload of a record
+struct AlignmentInput {
+  explicit AlignmentInput(istream* in) : in(in) {
+    if (BinaryAlignmentFormat::IsBinary(in)) {
+      binary.reset(new BinaryAlignmentReader(in));
+      if (!binary->ok()) {
+        cerr << "Bad binary alignment header\n";
+        exit(1);
+      }
+    }
   }
-  static bool Safe(const Array2D<bool>& a, int i, int j) {
-    if (i >= 0 && j >= 0 && i < static_cast<int>(a.width()) && j < static_cast<int>(a.height()))
-      return a(i,j);
-    else
+  bool good() const { return static_cast<bool>(*in); }
+  // false once the input is exhausted
+  bool Next(string* line) {
+    if (binary) {
+      if (binary->ReadRecord(line)) return true;
+      line->clear();
       return false;
-  }
-  virtual void Summary() { assert(!"Summary should have been overridden"); }
-};
-
-// compute fmeasure, second alignment is reference, first is hyp
-struct FMeasureCommand : public Command {
-  FMeasureCommand() : matches(), num_predicted(), num_in_ref() {}
-  int Result() const { return 2; }
-  string Name() const { return "fmeasure"; }
-  bool RequiresTwoOperands() const { return true; }
-  void Apply(const Array2D<bool>& hyp, const Array2D<bool>& ref, Array2D<bool>* x) {
-    (void) x;   // AER just computes statistics, not an alignment
-    unsigned i_len = ref.width();
-    unsigned j_len = ref.height();
-    for (unsigned i = 0; i < i_len; ++i) {
-      for (unsigned j = 0; j < j_len; ++j) {
-        if (ref(i,j)) {
-          ++num_in_ref;
-          if (Safe(hyp, i, j)) ++matches;
-        } 
-      }
     }
-    for (unsigned i = 0; i < hyp.width(); ++i)
-      for (unsigned j = 0; j < hyp.height(); ++j)
-        if (hyp(i,j)) ++num_predicted;
+    getline(*in, *line);
+    return static_cast<bool>(*in);
   }
-  void Summary() {
-    if (num_predicted == 0 || num_in_ref == 0) {
-      cerr << "Insufficient statistics to compute f-measure!\n";
+  void Parse(const string& line, Alignment* a) const {
+    double score;
+    if (!binary) {
+      AlignmentIO::ReadPharaohAlignment(line, a);
+    } else if (!BinaryAlignmentFormat::Decode(line, binary->has_scores(), a, &score)) {
+      cerr << "Malformed binary alignment record\n";
       abort();
     }
-    const double prec = static_cast<double>(matches) / num_predicted;
-    const double rec = static_cast<double>(matches) / num_in_ref;
-    cout << "P: " << prec << endl;
-    cout << "R: " << rec << endl;
-    const double f = (2.0 * prec * rec) / (rec + prec);
-    cout << "F: " << f << endl;
-  }
-  int matches;
-  int num_predicted;
-  int num_in_ref;
-};
-
-struct DisplayCommand : public Command {
-  string Name() const { return "display"; }
-  bool RequiresTwoOperands() const { return false; }
-  void Apply(const Array2D<bool>& in, const Array2D<bool>&, Array2D<bool>* x) {
-    *x = in;
-    cout << *x << endl;
-  }
-};
-
-struct ConvertCommand : public Command {
-  string Name() const { return "convert"; }
-  bool RequiresTwoOperands() const { return false; }
-  void Apply(const Array2D<bool>& in, const Array2D<bool>&, Array2D<bool>* x) {
-    *x = in;
-  }
-};
-
-struct InvertCommand : public Command {
-  string Name() const { return "invert"; }
-  bool RequiresTwoOperands() const { return false; }
-  void Apply(const Array2D<bool>& in, const Array2D<bool>&, Array2D<bool>* x) {
-    Array2D<bool>& res = *x;
-    res.resize(in.height(), in.width());
-    for (unsigned i = 0; i < in.height(); ++i)
-      for (unsigned j = 0; j < in.width(); ++j)
-        res(i, j) = in(j, i);
-  }
-};
-
-struct IntersectCommand : public Command {
-  string Name() const { return "intersect"; }
-  bool RequiresTwoOperands() const { return true; }
-  void Apply(const Array2D<bool>& a, const Array2D<bool>& b, Array2D<bool>* x) {
-    EnsureSize(a, b, x);
-    Array2D<bool>& res = *x;
-    for (unsigned i = 0; i < a.width(); ++i)
-      for (unsigned j = 0; j < a.height(); ++j)
-        res(i, j) = Safe(a, i, j) && Safe(b, i, j);
   }
-};
 
-struct UnionCommand : public Command {
-  string Name() const { return "union"; }
-  bool RequiresTwoOperands() const { return true; }
-  void Apply(const Array2D<bool>& a, const Array2D<bool>& b, Array2D<bool>* x) {
-    EnsureSize(a, b, x);
-    Array2D<bool>& res = *x;
-    for (unsigned i = 0; i < res.width(); ++i)
-      for (unsigned j = 0; j < res.height(); ++j)
-        res(i, j) = Safe(a, i, j) || Safe(b, i, j);
-  }
+  istream* in;
+  unique_ptr<BinaryAlignmentReader> binary;
 };
 
-struct RefineCommand : public Command {
-  RefineCommand() {
-    neighbors_.push_back(make_pair(1,0));
-    neighbors_.push_back(make_pair(-1,0));
-    neighbors_.push_back(make_pair(0,1));
-    neighbors_.push_back(make_pair(0,-1));
-  }
-  bool RequiresTwoOperands() const { return true; }
-
-  void Align(unsigned i, unsigned j) {
-    res_(i, j) = true;
-    is_i_aligned_[i] = true;
-    is_j_aligned_[j] = true;
-  }
+// true if reading stdin wouldn't block: there are buffered or pending
+// bytes, or the end of the input
+static bool StdinReady() {
+  if (cin.rdbuf()->in_avail() > 0) return true;
+  pollfd p = { 0, POLLIN, 0 };
+  return poll(&p, 1, 0) > 0;
+}
 
-  bool IsNeighborAligned(int i, int j) const {
-    for (unsigned k = 0; k < neighbors_.size(); ++k) {
-      const int di = neighbors_[k].first;
-      const int dj = neighbors_[k].second;
-      if (Safe(res_, i + di, j + dj))
-        return true;
+// reads up to n lines of every input into (*lines)[input]; exits if the
+// inputs have different numbers of lines. A batch read from stdin ends
+// early when no more input is ready, so that a program feeding atools a
+// line at a time through a pipe gets each answer without waiting for n
+// lines.
+void ReadBatch(const vector<unique_ptr<AlignmentInput> >& ins, const size_t n,
+    vector<vector<string> >* lines) {
+  lines->resize(ins.size());
+  for (vector<string>& l : *lines) l.clear();
+  vector<string> row(ins.size());
+  bool from_stdin = false;
+  for (const unique_ptr<AlignmentInput>& in : ins)
+    from_stdin = from_stdin || in->in == &cin;
+  while((*lines)[0].size() < n && ins[0]->good()) {
+    if (from_stdin && !(*lines)[0].empty() && !StdinReady()) break;
+    const bool more = ins[0]->Next(&row[0]);
+    for (size_t i = 1; i < ins.size(); ++i) {
+      if (more != ins[i]->Next(&row[i])) {
+        cerr << "Mismatched number of lines!\n";
+        exit(1);
+      }
     }
-    return false;
+    if (row[0].empty() && !more) break;
+    for (size_t i = 0; i < ins.size(); ++i)
+      (*lines)[i].push_back(row[i]);
   }
+}
 
-  bool IsNeitherAligned(int i, int j) const {
-    return !(is_i_aligned_[i] || is_j_aligned_[j]);
-  }
+// one command of the pipeline. Operands and outputs live in slots: one per
+// input, then one per stage.
+struct Stage {
+  Stage() : operands{-1, -1}, slot(-1), tee(-1) {}
+  string spec;
+  string name;
+  string command;
+  vector<string> operand_names;
+  int operands[2];
+  int slot;
+  int tee;  // index of the tee file, or -1
+};
 
-  bool IsOneOrBothUnaligned(int i, int j) const {
-    return !(is_i_aligned_[i] && is_j_aligned_[j]);
+// parses [NAME=]COMMAND[(OPERAND[,OPERAND])]; the name defaults to the
+// command
+bool ParseStage(const string& spec, Stage* st) {
+  string rest;
+  for (char c : spec)
+    if (c != ' ') rest += c;
+  const size_t open = rest.find('(');
+  const size_t eq = rest.find('=');
+  if (eq != string::npos && eq < open) {
+    st->name = rest.substr(0, eq);
+    rest = rest.substr(eq + 1);
   }
-
-  bool KoehnAligned(int i, int j) const {
-    return IsOneOrBothUnaligned(i, j) && IsNeighborAligned(i, j);
+  const size_t paren = rest.find('(');
+  st->command = rest.substr(0, paren);
+  if (paren != string::npos) {
+    if (rest[rest.size() - 1] != ')') return false;
+    istringstream args(rest.substr(paren + 1, rest.size() - paren - 2));
+    string arg;
+    while (getline(args, arg, ','))
+      st->operand_names.push_back(arg);
+    if (st->operand_names.empty()) return false;
   }
+  if (st->name.empty()) st->name = st->command;
+  st->spec = spec;
+  return !st->command.empty() && !st->name.empty();
+}
 
-  typedef bool (RefineCommand::*Predicate)(int i, int j) const;
-
- protected:
-  void InitRefine(
-      const Array2D<bool>& a,
-      const Array2D<bool>& b) {
-    res_.clear();
-    EnsureSize(a, b, &res_);
-    in_.clear(); un_.clear(); is_i_aligned_.clear(); is_j_aligned_.clear();
-    EnsureSize(a, b, &in_);
-    EnsureSize(a, b, &un_);
-    is_i_aligned_.resize(res_.width(), false);
-    is_j_aligned_.resize(res_.height(), false);
-    for (unsigned i = 0; i < in_.width(); ++i)
-      for (unsigned j = 0; j < in_.height(); ++j) {
-        un_(i, j) = Safe(a, i, j) || Safe(b, i, j);
-        in_(i, j) = Safe(a, i, j) && Safe(b, i, j);
-        if (in_(i, j)) Align(i, j);
-    }
-  }
-  // "grow" the resulting alignment using the points in adds
-  // if they match the constraints determined by pred
-  void Grow(Predicate pred, bool idempotent, const Array2D<bool>& adds) {
-    if (idempotent) {
-      for (unsigned i = 0; i < adds.width(); ++i)
-        for (unsigned j = 0; j < adds.height(); ++j) {
-          if (adds(i, j) && !res_(i, j) &&
-              (this->*pred)(i, j)) Align(i, j);
-        }
-      return;
-    }
-    set<pair<int, int> > p;
-    for (unsigned i = 0; i < adds.width(); ++i)
-      for (unsigned j = 0; j < adds.height(); ++j)
-        if (adds(i, j) && !res_(i, j))
-          p.insert(make_pair(i, j));
-    bool keep_going = !p.empty();
-    while (keep_going) {
-      keep_going = false;
-      set<pair<int, int> > added;
-      for (set<pair<int, int> >::iterator pi = p.begin(); pi != p.end(); ++pi) {
-        if ((this->*pred)(pi->first, pi->second)) {
-          Align(pi->first, pi->second);
-          added.insert(make_pair(pi->first, pi->second));
-          keep_going = true;
-        }
+// a stream of alignments in Pharaoh text or the binary format, to a file
+// (with the index in FILE.idx) or to stdout
+struct AlignmentOutput {
+  AlignmentOutput(const string& path, bool binary) : out(&cout) {
+    if (!path.empty()) {
+      file.reset(new ofstream(path.c_str(), ios::binary));
+      if (!*file) {
+        cerr << "Can't write " << path << endl;
+        exit(1);
       }
-      for (set<pair<int, int> >::iterator ai = added.begin(); ai != added.end(); ++ai)
-        p.erase(*ai);
+      out = file.get();
+      if (binary)
+        index.reset(new ofstream((path + ".idx").c_str(), ios::binary));
     }
+    if (binary)
+      writer.reset(new BinaryAlignmentWriter(out, index.get(), false));
   }
-  Array2D<bool> res_;  // refined alignment
-  Array2D<bool> in_;   // intersection alignment
-  Array2D<bool> un_;   // union alignment
-  vector<bool> is_i_aligned_;
-  vector<bool> is_j_aligned_;
-  vector<pair<int,int> > neighbors_;
-};
-
-struct DiagCommand : public RefineCommand {
-  DiagCommand() {
-    neighbors_.push_back(make_pair(1,1));
-    neighbors_.push_back(make_pair(-1,1));
-    neighbors_.push_back(make_pair(1,-1));
-    neighbors_.push_back(make_pair(-1,-1));
-  }
-};
-
-struct GDCommand : public DiagCommand {
-  string Name() const { return "grow-diag"; }
-  void Apply(const Array2D<bool>& a, const Array2D<bool>& b, Array2D<bool>* x) {
-    InitRefine(a, b);
-    Grow(&RefineCommand::KoehnAligned, false, un_);
-    *x = res_;
+  // an encoded record in binary mode, else text
+  void Write(const string& o) {
+    if (writer)
+      writer->WriteEncoded(o);
+    else
+      *out << o;
   }
-};
-
-struct GDFCommand : public DiagCommand {
-  string Name() const { return "grow-diag-final"; }
-  void Apply(const Array2D<bool>& a, const Array2D<bool>& b, Array2D<bool>* x) {
-    InitRefine(a, b);
-    Grow(&RefineCommand::KoehnAligned, false, un_);
-    Grow(&RefineCommand::IsOneOrBothUnaligned, true, a);
-    Grow(&RefineCommand::IsOneOrBothUnaligned, true, b);
-    *x = res_;
+  void Close() {
+    if (writer) writer->Close();
+    out->flush();
   }
-};
 
-struct GDFACommand : public DiagCommand {
-  string Name() const { return "grow-diag-final-and"; }
-  void Apply(const Array2D<bool>& a, const Array2D<bool>& b, Array2D<bool>* x) {
-    InitRefine(a, b);
-    Grow(&RefineCommand::KoehnAligned, false, un_);
-    Grow(&RefineCommand::IsNeitherAligned, true, a);
-    Grow(&RefineCommand::IsNeitherAligned, true, b);
-    *x = res_;
-  }
+  ostream* out;
+  unique_ptr<ofstream> file;
+  unique_ptr<ofstream> index;
+  unique_ptr<BinaryAlignmentWriter> writer;
 };
 
-map<string, shared_ptr<Command> > commands;
-
-template<class C> static void AddCommand() {
-  C* c = new C;
-  commands[c->Name()].reset(c);
-}
-
 int main(int argc, char **argv) {
   AddCommand<ConvertCommand>();
   AddCommand<DisplayCommand>();
@@ -308,71 +251,236 @@ int main(int argc, char **argv) {
   AddCommand<GDFACommand>();
   AddCommand<FMeasureCommand>();
   if (!InitCommandLine(argc, argv)) {
-    cerr << "Usage: " << argv[0] << " -c COMMAND -i FILE1.AL [-j FILE2.AL]\n";
+    cerr << "Usage: " << argv[0] << " -c COMMAND -i FILE1.AL [-j FILE2.AL]\n"
+         << "  [-n, --input NAME=FILE.AL] (more inputs, for pipelines)\n"
+         << "  [-c [NAME=]COMMAND[(OPERAND[,OPERAND])] ...] (a pipeline: operands\n"
+         << "  are inputs or earlier stages, by default -i and -j for the first\n"
+         << "  stage and the previous stage for later one-operand commands)\n"
+         << "  [-T, --tee NAME=FILE] (also write the output of stage NAME to FILE)\n"
+         << "  [-t, --threads N] [-b, --batch_size LINES (default 10000)]\n"
+         << "  [-o, --output FILE] [-B, --binary: write the binary format, with\n"
+         << "  an index in FILE.idx if -o is given; inputs may be in either format]\n";
     cerr << "Valid options for COMMAND:";
     for (auto it : commands)
       cerr << ' ' << it.first;
     cerr << endl;
     return 1;
   }
-  if (commands.count(command) == 0) {
-    cerr << "Don't understand command: " << command << endl;
-    return 1;
+  vector<pair<string, string> > input_files;
+  if (!input_1.empty()) input_files.push_back(make_pair("i", input_1));
+  if (!input_2.empty()) input_files.push_back(make_pair("j", input_2));
+  input_files.insert(input_files.end(), named_inputs.begin(), named_inputs.end());
+  map<string, int> slots;
+  for (size_t i = 0; i < input_files.size(); ++i) {
+    if (slots.count(input_files[i].first)) {
+      cerr << "Input '" << input_files[i].first << "' given twice\n";
+      return 1;
+    }
+    slots[input_files[i].first] = i;
   }
-  if (commands[command]->RequiresTwoOperands()) {
-    if (input_2.size() == 0) {
-      cerr << "Command '" << command << "' requires two alignment files\n";
+  const int num_inputs = input_files.size();
+  vector<Stage> stages(stage_specs.size());
+  vector<bool> used(num_inputs);
+  for (size_t s = 0; s < stages.size(); ++s) {
+    Stage& st = stages[s];
+    if (!ParseStage(stage_specs[s], &st)) {
+      cerr << "Can't parse command: " << stage_specs[s] << endl;
       return 1;
     }
-  } else {
-    if (input_2.size() != 0) {
-      cerr << "Command '" << command << "' requires only one alignment file\n";
+    if (commands.count(st.command) == 0) {
+      cerr << "Don't understand command: " << st.command << endl;
+      return 1;
+    }
+    const unsigned arity = commands[st.command]->RequiresTwoOperands() ? 2 : 1;
+    if (st.operand_names.empty()) {
+      if (s == 0) {
+        if (arity == 2 && num_inputs < 2) {
+          cerr << "Command '" << st.command << "' requires two alignment files\n";
+          return 1;
+        }
+        if (arity == 1 && num_inputs > 1 && stages.size() == 1) {
+          cerr << "Command '" << st.command << "' requires only one alignment file\n";
+          return 1;
+        }
+        for (unsigned a = 0; a < arity; ++a)
+          st.operand_names.push_back(input_files[a].first);
+      } else if (arity == 1) {
+        st.operand_names.push_back(stages[s - 1].name);
+      } else {
+        cerr << "Command '" << st.spec << "' needs its operands, e.g. "
+             << st.command << "(A,B)\n";
+        return 1;
+      }
+    }
+    if (st.operand_names.size() != arity) {
+      cerr << "Command '" << st.spec << "' takes " << arity << " operand"
+           << (arity == 1 ? "" : "s") << endl;
+      return 1;
+    }
+    for (unsigned a = 0; a < arity; ++a) {
+      const string& name = st.operand_names[a];
+      if (slots.count(name) == 0) {
+        cerr << "Unknown input or stage '" << name << "' in '" << st.spec << "'\n";
+        return 1;
+      }
+      const int slot = slots[name];
+      if (slot >= num_inputs &&
+          commands[stages[slot - num_inputs].command]->Result() != 1) {
+        cerr << "'" << name << "' computes statistics, not alignments\n";
+        return 1;
+      }
+      if (slot < num_inputs) used[slot] = true;
+      st.operands[a] = slot;
+    }
+    if (slots.count(st.name)) {
+      cerr << "Name '" << st.name << "' is used twice; name the stage with "
+           << "NAME=" << st.command << endl;
+      return 1;
+    }
+    st.slot = num_inputs + s;
+    slots[st.name] = st.slot;
+    if (binary_output && st.command == "display") {
+      cerr << "display only writes text\n";
       return 1;
     }
   }
-  Command& cmd = *commands[command];
-  istream* in1 = NULL;
-  if (input_1 == "-") {
-    in1 = &cin;
-  } else {
-    in1 = new ifstream(input_1.c_str());
-  }
-  istream* in2 = NULL;
-  if (cmd.RequiresTwoOperands()) {
-    if (input_2 == "-") {
-      in2 = &cin;
-    } else {
-      in2 = new ifstream(input_2.c_str());
+  for (int i = 0; i < num_inputs; ++i) {
+    if (!used[i]) {
+      cerr << "Input '" << input_files[i].first << "' isn't used by any command\n";
+      return 1;
     }
   }
-  string line1;
-  string line2;
-  while(*in1) {
-    getline(*in1, line1);
-    if (in2) {
-      getline(*in2, line2);
-      if ((*in1 && !*in2) || (*in2 && !*in1)) {
-        cerr << "Mismatched number of lines!\n";
-        exit(1);
-      }
+  for (size_t k = 0; k < tees.size(); ++k) {
+    const string& name = tees[k].first;
+    if (slots.count(name) == 0 || slots[name] < num_inputs) {
+      cerr << "No stage named '" << name << "' to tee\n";
+      return 1;
     }
-    if (line1.empty() && !*in1) break;
-    shared_ptr<Array2D<bool> > out(new Array2D<bool>);
-    shared_ptr<Array2D<bool> > a1 = AlignmentIO::ReadPharaohAlignmentGrid(line1);
-    if (in2) {
-      shared_ptr<Array2D<bool> > a2 = AlignmentIO::ReadPharaohAlignmentGrid(line2);
-      cmd.Apply(*a1, *a2, out.get());
-    } else {
-      Array2D<bool> dummy;
-      cmd.Apply(*a1, dummy, out.get());
+    Stage& st = stages[slots[name] - num_inputs];
+    if (commands[st.command]->Result() != 1) {
+      cerr << "'" << name << "' computes statistics, not alignments\n";
+      return 1;
     }
-    
-    if (cmd.Result() == 1) {
-      AlignmentIO::SerializePharaohFormat(*out, &cout);
+    if (st.tee >= 0) {
+      cerr << "Stage '" << name << "' is teed twice\n";
+      return 1;
     }
+    st.tee = k;
   }
-  if (cmd.Result() == 2)
+  const Stage& last = stages.back();
+  const bool write_last = commands[last.command]->Result() == 1;
+  if (!write_last && !output.empty()) {
+    // its statistics go to stdout, -o would only be left empty
+    cerr << "-o: the last stage '" << last.name << "' computes statistics, "
+         << "not alignments\n";
+    return 1;
+  }
+#ifdef _OPENMP
+  if (num_threads > 0) omp_set_num_threads(num_threads);
+  const int threads = omp_get_max_threads();
+#else
+  const int threads = 1;
+#endif
+  // the lines of a batch are processed in parallel, each thread with its
+  // own commands, and written out in input order. Every line goes through
+  // the whole pipeline in memory.
+  vector<vector<unique_ptr<Command> > > cmds(threads);
+  for (int t = 0; t < threads; ++t) {
+    cmds[t].resize(stages.size());
+    for (size_t s = 0; s < stages.size(); ++s)
+      cmds[t][s].reset(factories[stages[s].command]());
+  }
+  vector<unique_ptr<ifstream> > files;
+  vector<unique_ptr<AlignmentInput> > ins;
+  // several inputs may be "-": they then take turns reading lines of
+  // stdin, as with -i - -j -
+  for (int i = 0; i < num_inputs; ++i) {
+    istream* in = &cin;
+    if (input_files[i].second != "-") {
+      files.emplace_back(new ifstream(input_files[i].second.c_str()));
+      in = files.back().get();
+    }
+    ins.emplace_back(new AlignmentInput(in));
+  }
+  AlignmentOutput out(output, binary_output && write_last);
+  vector<unique_ptr<AlignmentOutput> > tee_outs;
+  for (size_t k = 0; k < tees.size(); ++k)
+    tee_outs.emplace_back(new AlignmentOutput(tees[k].second, binary_output));
+  vector<vector<string> > lines;
+  // outputs[0] for the last stage, outputs[1 + k] for tee k
+  vector<vector<string> > outputs(1 + tees.size());
+  while (true) {
+    ReadBatch(ins, batch_size, &lines);
+    if (lines[0].empty()) break;
+    for (vector<string>& o : outputs)
+      o.resize(lines[0].size());
+#pragma omp parallel
+    {
+      int t = 0;
+#ifdef _OPENMP
+      t = omp_get_thread_num();
+#endif
+      vector<unique_ptr<Command> >& c = cmds[t];
+      ostringstream os;
+      ostringstream tee_os;
+      for (size_t s = 0; s < stages.size(); ++s)
+        c[s]->out = &os;
+      vector<Alignment> values(num_inputs + stages.size());
+      const Alignment none;
+#pragma omp for schedule(dynamic, 64)
+      for (int k = 0; k < static_cast<int>(lines[0].size()); ++k) {
+        os.str("");
+        for (int i = 0; i < num_inputs; ++i)
+          ins[i]->Parse(lines[i][k], &values[i]);
+        for (size_t s = 0; s < stages.size(); ++s) {
+          const Stage& st = stages[s];
+          c[s]->Apply(values[st.operands[0]],
+              st.operands[1] < 0 ? none : values[st.operands[1]],
+              &values[st.slot]);
+          if (st.tee < 0) continue;
+          string* o = &outputs[1 + st.tee][k];
+          if (binary_output) {
+            BinaryAlignmentFormat::Encode(values[st.slot], false, 0, o);
+          } else {
+            tee_os.str("");
+            AlignmentIO::SerializePharaohFormat(values[st.slot], &tee_os);
+            *o = tee_os.str();
+          }
+        }
+        if (write_last && binary_output) {
+          BinaryAlignmentFormat::Encode(values[last.slot], false, 0, &outputs[0][k]);
+          continue;
+        }
+        if (write_last) {
+          AlignmentIO::SerializePharaohFormat(values[last.slot], &os);
+        }
+        outputs[0][k] = os.str();
+      }
+      for (size_t s = 0; s < stages.size(); ++s)
+        c[s]->out = &cout;
+    }
+    for (const string& o : outputs[0])
+      out.Write(o);
+    for (size_t k = 0; k < tees.size(); ++k)
+      for (const string& o : outputs[1 + k])
+        tee_outs[k]->Write(o);
+    // the answers to everything read so far
+    out.out->flush();
+  }
+  out.Close();
+  for (size_t k = 0; k < tees.size(); ++k)
+    tee_outs[k]->Close();
+  // statistics, labelled by stage if there are several
+  unsigned summaries = 0;
+  for (size_t s = 0; s < stages.size(); ++s)
+    summaries += cmds[0][s]->Result() == 2;
+  for (size_t s = 0; s < stages.size(); ++s) {
+    Command& cmd = *cmds[0][s];
+    if (cmd.Result() != 2) continue;
+    for (int t = 1; t < threads; ++t)
+      cmd.Merge(*cmds[t][s]);
+    if (summaries > 1) cout << stages[s].name << ":\n";
     cmd.Summary();
+  }
   return 0;
 }
-
@@ -0,0 +1,340 @@
+#ifndef ATOOLS_COMMANDS_H_
+#define ATOOLS_COMMANDS_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/alignment_io.h"
+
+// Operations on word alignment grids run by atools, one pair of lines at a
+// time (see atools.cc for the command line driver). The driver gives each
+// thread its own instance, so Apply may keep scratch state in members;
+// Merge adds up the statistics of summary commands afterwards.
+struct Command {
+  Command() : out(&std::cout) {}
+  virtual ~Command() {}
+  virtual std::string Name() const = 0;
+
+  // returns 1 for alignment grid output [default]
+  // returns 2 if Summary() should be called [for AER, etc]
+  virtual int Result() const { return 1; }
+
+  virtual bool RequiresTwoOperands() const { return true; }
+  virtual void Apply(const Alignment& a, const Alignment& b, Alignment* x) = 0;
+  void EnsureSize(const Alignment& a, const Alignment& b, Alignment* x) {
+    x->width = std::max(a.width, b.width);
+    x->height = std::max(a.height, b.height);
+  }
+  virtual void Summary() { assert(!"Summary should have been overridden"); }
+  // adds the statistics gathered by another instance of the same command
+  virtual void Merge(const Command& other) { (void) other; }
+
+  std::ostream* out;  // where commands that print while applying write
+};
+
+// compute fmeasure, second alignment is reference, first is hyp
+struct FMeasureCommand : public Command {
+  FMeasureCommand() : matches(), num_predicted(), num_in_ref() {}
+  int Result() const { return 2; }
+  std::string Name() const { return "fmeasure"; }
+  bool RequiresTwoOperands() const { return true; }
+  void Apply(const Alignment& hyp, const Alignment& ref, Alignment* x) {
+    (void) x;   // AER just computes statistics, not an alignment
+    num_in_ref += ref.links.size();
+    num_predicted += hyp.links.size();
+    // both link lists are sorted
+    std::vector<Alignment::Link>::const_iterator h = hyp.links.begin();
+    for (const Alignment::Link& r : ref.links) {
+      while (h != hyp.links.end() && *h < r) ++h;
+      if (h != hyp.links.end() && *h == r) ++matches;
+    }
+  }
+  void Summary() {
+    if (num_predicted == 0 || num_in_ref == 0) {
+      std::cerr << "Insufficient statistics to compute f-measure!\n";
+      abort();
+    }
+    const double prec = static_cast<double>(matches) / num_predicted;
+    const double rec = static_cast<double>(matches) / num_in_ref;
+    std::cout << "P: " << prec << std::endl;
+    std::cout << "R: " << rec << std::endl;
+    const double f = (2.0 * prec * rec) / (rec + prec);
+    std::cout << "F: " << f << std::endl;
+  }
+  void Merge(const Command& other) {
+    const FMeasureCommand& o = static_cast<const FMeasureCommand&>(other);
+    matches += o.matches;
+    num_predicted += o.num_predicted;
+    num_in_ref += o.num_in_ref;
+  }
+  int matches;
+  int num_predicted;
+  int num_in_ref;
+};
+
+struct DisplayCommand : public Command {
+  std::string Name() const { return "display"; }
+  bool RequiresTwoOperands() const { return false; }
+  void Apply(const Alignment& in, const Alignment&, Alignment* x) {
+    *x = in;
+    x->ToGrid(&grid_);
+    *out << grid_ << std::endl;
+  }
+ private:
+  Array2D<bool> grid_;
+};
+
+struct ConvertCommand : public Command {
+  std::string Name() const { return "convert"; }
+  bool RequiresTwoOperands() const { return false; }
+  void Apply(const Alignment& in, const Alignment&, Alignment* x) {
+    *x = in;
+  }
+};
+
+struct InvertCommand : public Command {
+  std::string Name() const { return "invert"; }
+  bool RequiresTwoOperands() const { return false; }
+  void Apply(const Alignment& in, const Alignment&, Alignment* x) {
+    x->width = in.height;
+    x->height = in.width;
+    x->links.resize(in.links.size());
+    for (size_t k = 0; k < in.links.size(); ++k)
+      x->links[k] = Alignment::Link(in.links[k].second, in.links[k].first);
+    std::sort(x->links.begin(), x->links.end());
+  }
+};
+
+struct IntersectCommand : public Command {
+  std::string Name() const { return "intersect"; }
+  bool RequiresTwoOperands() const { return true; }
+  void Apply(const Alignment& a, const Alignment& b, Alignment* x) {
+    EnsureSize(a, b, x);
+    x->links.clear();
+    std::set_intersection(a.links.begin(), a.links.end(), b.links.begin(),
+                          b.links.end(), std::back_inserter(x->links));
+  }
+};
+
+struct UnionCommand : public Command {
+  std::string Name() const { return "union"; }
+  bool RequiresTwoOperands() const { return true; }
+  void Apply(const Alignment& a, const Alignment& b, Alignment* x) {
+    EnsureSize(a, b, x);
+    x->links.clear();
+    std::set_union(a.links.begin(), a.links.end(), b.links.begin(),
+                   b.links.end(), std::back_inserter(x->links));
+  }
+};
+
+// Symmetrization heuristics of Koehn et al. The alignment grows from the
+// intersection of the two operands by adding links of their union. The
+// state lives in a grid of flags over the (reused) cells of the pair, so
+// nothing is allocated per line once the buffers are large enough, and
+// only the cells of union links are ever written (and later cleared).
+struct RefineCommand : public Command {
+  RefineCommand() {
+    neighbors_.push_back(std::make_pair(1,0));
+    neighbors_.push_back(std::make_pair(-1,0));
+    neighbors_.push_back(std::make_pair(0,1));
+    neighbors_.push_back(std::make_pair(0,-1));
+  }
+  bool RequiresTwoOperands() const { return true; }
+
+  void Align(unsigned i, unsigned j) {
+    flags_[i * res_.height + j] |= kAligned;
+    res_.links.push_back(Alignment::Link(i, j));
+    is_i_aligned_[i] = true;
+    is_j_aligned_[j] = true;
+  }
+
+  bool IsAligned(int i, int j) const {
+    return i >= 0 && j >= 0 && i < static_cast<int>(res_.width) &&
+        j < static_cast<int>(res_.height) &&
+        (flags_[i * res_.height + j] & kAligned);
+  }
+
+  bool IsNeighborAligned(int i, int j) const {
+    for (unsigned k = 0; k < neighbors_.size(); ++k) {
+      const int di = neighbors_[k].first;
+      const int dj = neighbors_[k].second;
+      if (IsAligned(i + di, j + dj))
+        return true;
+    }
+    return false;
+  }
+
+  bool IsNeitherAligned(int i, int j) const {
+    return !(is_i_aligned_[i] || is_j_aligned_[j]);
+  }
+
+  bool IsOneOrBothUnaligned(int i, int j) const {
+    return !(is_i_aligned_[i] && is_j_aligned_[j]);
+  }
+
+  bool KoehnAligned(int i, int j) const {
+    return IsOneOrBothUnaligned(i, j) && IsNeighborAligned(i, j);
+  }
+
+  typedef bool (RefineCommand::*Predicate)(int i, int j) const;
+
+ protected:
+  enum {
+    kUnion = 1,      // link of either operand
+    kAligned = 2,    // link of the result
+    kQueued = 4,     // waiting to be visited in the current sweep
+    kNextSweep = 8,  // waiting to be visited in the next sweep
+  };
+
+  void InitRefine(const Alignment& a, const Alignment& b) {
+    EnsureSize(a, b, &res_);
+    res_.links.clear();
+    if (flags_.size() < static_cast<size_t>(res_.width) * res_.height)
+      flags_.resize(static_cast<size_t>(res_.width) * res_.height);
+    is_i_aligned_.assign(res_.width, false);
+    is_j_aligned_.assign(res_.height, false);
+    un_.links.clear();
+    std::set_union(a.links.begin(), a.links.end(), b.links.begin(),
+                   b.links.end(), std::back_inserter(un_.links));
+    for (const Alignment::Link& l : un_.links)
+      flags_[l.first * res_.height + l.second] = kUnion;
+    // the intersection, in order
+    std::vector<Alignment::Link>::const_iterator bi = b.links.begin();
+    for (const Alignment::Link& l : a.links) {
+      while (bi != b.links.end() && *bi < l) ++bi;
+      if (bi != b.links.end() && *bi == l) Align(l.first, l.second);
+    }
+  }
+
+  // "grow" the resulting alignment using the points in adds
+  // if they match the constraints determined by pred
+  //
+  // Idempotent growing visits the points once, in (i, j) order. Otherwise
+  // the points are swept in (i, j) order until a sweep adds nothing, and
+  // a point is accepted as soon as pred holds when it is visited. Only
+  // the neighbors of an added point can change from rejected to accepted,
+  // so instead of rescanning, each sweep visits just the points whose
+  // neighbors were added since their last visit: those after the added
+  // point later in the same sweep, those before it in the next sweep. pred
+  // must depend on no other points than the neighbors, the rows and the
+  // columns, which is what gives the same result as the full rescans.
+  void Grow(Predicate pred, bool idempotent, const Alignment& adds) {
+    if (idempotent) {
+      for (const Alignment::Link& l : adds.links)
+        if (!IsAligned(l.first, l.second) && (this->*pred)(l.first, l.second))
+          Align(l.first, l.second);
+      return;
+    }
+    const unsigned h = res_.height;
+    next_.clear();
+    for (const Alignment::Link& l : adds.links) {
+      const unsigned p = l.first * h + l.second;
+      if (flags_[p] & kAligned) continue;
+      flags_[p] |= kNextSweep;
+      next_.push_back(p);
+    }
+    while (!next_.empty()) {
+      sweep_.swap(next_);
+      next_.clear();
+      for (const unsigned p : sweep_)
+        flags_[p] = (flags_[p] & ~kNextSweep) | kQueued;
+      std::make_heap(sweep_.begin(), sweep_.end(), std::greater<unsigned>());
+      while (!sweep_.empty()) {
+        std::pop_heap(sweep_.begin(), sweep_.end(), std::greater<unsigned>());
+        const unsigned p = sweep_.back();
+        sweep_.pop_back();
+        flags_[p] &= ~kQueued;
+        const int i = p / h;
+        const int j = p % h;
+        if (!(this->*pred)(i, j)) continue;
+        Align(i, j);
+        for (unsigned k = 0; k < neighbors_.size(); ++k) {
+          const int ni = i + neighbors_[k].first;
+          const int nj = j + neighbors_[k].second;
+          if (ni < 0 || nj < 0 || ni >= static_cast<int>(res_.width) ||
+              nj >= static_cast<int>(h))
+            continue;
+          const unsigned q = ni * h + nj;
+          if (flags_[q] != kUnion) continue;  // not a pending point of adds
+          if (q > p) {
+            flags_[q] |= kQueued;
+            sweep_.push_back(q);
+            std::push_heap(sweep_.begin(), sweep_.end(), std::greater<unsigned>());
+          } else {
+            flags_[q] |= kNextSweep;
+            next_.push_back(q);
+          }
+        }
+      }
+    }
+  }
+
+  // writes the result to x and clears the flags for the next pair
+  void FinishRefine(Alignment* x) {
+    for (const Alignment::Link& l : un_.links)
+      flags_[l.first * res_.height + l.second] = 0;
+    std::sort(res_.links.begin(), res_.links.end());
+    x->width = res_.width;
+    x->height = res_.height;
+    x->links = res_.links;
+  }
+
+  Alignment res_;  // refined alignment
+  Alignment un_;   // union alignment
+  std::vector<unsigned char> flags_;  // res_.width x res_.height cells
+  std::vector<unsigned> sweep_;       // min-heap of cells
+  std::vector<unsigned> next_;
+  std::vector<bool> is_i_aligned_;
+  std::vector<bool> is_j_aligned_;
+  std::vector<std::pair<int,int> > neighbors_;
+};
+
+struct DiagCommand : public RefineCommand {
+  DiagCommand() {
+    neighbors_.push_back(std::make_pair(1,1));
+    neighbors_.push_back(std::make_pair(-1,1));
+    neighbors_.push_back(std::make_pair(1,-1));
+    neighbors_.push_back(std::make_pair(-1,-1));
+  }
+};
+
+struct GDCommand : public DiagCommand {
+  std::string Name() const { return "grow-diag"; }
+  void Apply(const Alignment& a, const Alignment& b, Alignment* x) {
+    InitRefine(a, b);
+    Grow(&RefineCommand::KoehnAligned, false, un_);
+    FinishRefine(x);
+  }
+};
+
+struct GDFCommand : public DiagCommand {
+  std::string Name() const { return "grow-diag-final"; }
+  void Apply(const Alignment& a, const Alignment& b, Alignment* x) {
+    InitRefine(a, b);
+    Grow(&RefineCommand::KoehnAligned, false, un_);
+    Grow(&RefineCommand::IsOneOrBothUnaligned, true, a);
+    Grow(&RefineCommand::IsOneOrBothUnaligned, true, b);
+    FinishRefine(x);
+  }
+};
+
+struct GDFACommand : public DiagCommand {
+  std::string Name() const { return "grow-diag-final-and"; }
+  void Apply(const Alignment& a, const Alignment& b, Alignment* x) {
+    InitRefine(a, b);
+    Grow(&RefineCommand::KoehnAligned, false, un_);
+    Grow(&RefineCommand::IsNeitherAligned, true, a);
+    Grow(&RefineCommand::IsNeitherAligned, true, b);
+    FinishRefine(x);
+  }
+};
+
+#endif
@@ -0,0 +1,91 @@
+#!/bin/sh
+# Checks atools pipelines against the single commands they chain: a chain
+# of -c stages over -i, -j and -n inputs, with -T tees, must write what
+# running each command on its own writes, in text and binary, with any
+# batch size; and the option combinations atools refuses must fail.
+#
+#   atools_test.sh ATOOLS    exit status 1 on a failure
+
+ATOOLS=$1
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+failures=0
+
+check() {
+  if [ "$2" = ok ]; then
+    echo "$1: ok"
+  else
+    echo "$1: FAILED"
+    failures=$((failures + 1))
+  fi
+}
+
+same() {
+  if cmp -s "$2" "$3"; then check "$1" ok; else check "$1" FAILED; fi
+}
+
+# fails if atools accepts the arguments
+refuses() {
+  name=$1
+  shift
+  if "$ATOOLS" "$@" > "$T/out" 2> /dev/null; then
+    check "$name" FAILED
+  else
+    check "$name" ok
+  fi
+}
+
+printf '%s\n' '0-0 1-1 2-2' '0-1 1-0 2-3 3-2' '' '0-0 2-1 2-2 4-3' \
+  '1-0 1-1 3-3' '0-0' > "$T/fwd"
+printf '%s\n' '0-0 1-2 2-2' '0-1 1-0 3-2' '0-0' '0-0 1-1 2-2 4-4' \
+  '1-1 2-2 3-3' '0-0 1-1' > "$T/rev"
+printf '%s\n' '0-0 1-1 2-2' '0-1 1-0 2-3 3-2' '0-0' '0-0 1-1 2-2 4-3' \
+  '1-1 2-2 3-3' '0-0' > "$T/ref"
+
+# the commands one at a time
+"$ATOOLS" -i "$T/fwd" -j "$T/rev" -c grow-diag-final-and > "$T/sym"
+"$ATOOLS" -i "$T/sym" -c invert > "$T/inv"
+"$ATOOLS" -i "$T/inv" -j "$T/ref" -c fmeasure > "$T/score"
+"$ATOOLS" -i "$T/fwd" -j "$T/rev" -c intersect > "$T/both"
+"$ATOOLS" -i "$T/both" -j "$T/sym" -c union > "$T/merged"
+
+"$ATOOLS" -i "$T/fwd" -j "$T/rev" -n ref="$T/ref" -c sym=grow-diag-final-and \
+  -T sym="$T/tee" -c invert -c 'fmeasure(invert,ref)' > "$T/chain"
+same pipeline_chain "$T/score" "$T/chain"
+same pipeline_tee "$T/sym" "$T/tee"
+
+# named operands, two tees, the last stage to -o, small batches
+"$ATOOLS" -n a="$T/fwd" -n b="$T/rev" -c s=grow-diag-final-and \
+  -c 'x=intersect(a,b)' -c 'union(x,s)' -T x="$T/tee_x" -T s="$T/tee_s" \
+  -o "$T/out" -b 2 -t 2
+same pipeline_named "$T/merged" "$T/out"
+same pipeline_two_tees "$T/both" "$T/tee_x"
+same pipeline_two_tees_s "$T/sym" "$T/tee_s"
+
+# an input from stdin
+"$ATOOLS" -i "$T/fwd" -n r=- -c 'grow-diag-final-and(i,r)' < "$T/rev" \
+  > "$T/out"
+same pipeline_stdin "$T/sym" "$T/out"
+
+# binary output of the last stage and the tees, read back by atools
+"$ATOOLS" -i "$T/fwd" -j "$T/rev" -c sym=grow-diag-final-and -T sym="$T/tee.bin" \
+  -c invert -B -o "$T/out.bin"
+"$ATOOLS" -i "$T/out.bin" -c convert > "$T/out"
+same pipeline_binary "$T/inv" "$T/out"
+"$ATOOLS" -i "$T/tee.bin" -c convert > "$T/out"
+same pipeline_binary_tee "$T/sym" "$T/out"
+
+refuses pipeline_refuses_tee_twice -i "$T/fwd" -j "$T/rev" \
+  -c sym=grow-diag -T sym="$T/a" -T sym="$T/b"
+refuses pipeline_refuses_output_of_statistics -i "$T/fwd" -j "$T/ref" \
+  -c fmeasure -o "$T/out"
+refuses pipeline_refuses_tee_of_statistics -i "$T/fwd" -j "$T/ref" \
+  -c fmeasure -T fmeasure="$T/out"
+refuses pipeline_refuses_unknown_operand -i "$T/fwd" -j "$T/rev" \
+  -c 'union(i,k)'
+refuses pipeline_refuses_name_twice -i "$T/fwd" -j "$T/rev" \
+  -c union -c 'union(i,j)'
+refuses pipeline_refuses_unused_input -i "$T/fwd" -j "$T/rev" \
+  -n ref="$T/ref" -c union
+
+[ "$failures" -eq 0 ]
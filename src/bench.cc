@@ -0,0 +1,594 @@
+// Microbenchmarks for the hot paths of fast_align and atools, run on a
+// synthetic corpus (see synthetic_corpus.h). Every benchmark prints one JSON
+// object per line with its median time over several repetitions; the corpus
+// is generated from a fixed seed, so runs are comparable across builds.
+//
+//   bench [options]            run all benchmarks (-f NAME to select)
+//   bench -g [options] > FILE  only write the synthetic corpus
+//   bench -c [options]         check the E-step and M-step against a plain
+//                              reference implementation (exit status 1 on
+//                              a mismatch)
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "src/atools_commands.h"
+#include "src/compact_ttable.h"
+#include "src/corpus.h"
+#include "src/da.h"
+#include "src/posterior.h"
+#include "src/run_stats.h"
+#include "src/synthetic_corpus.h"
+#include "src/ttables.h"
+
+using namespace std;
+
+#if defined(USE_FLAT_HASH)
+const char* kBackend = "flat";
+#elif defined(HAVE_SPARSEHASH)
+const char* kBackend = "sparsehash";
+#else
+const char* kBackend = "unordered_map";
+#endif
+
+SyntheticCorpus::Options corpus_opts;
+int num_lines = 20000;
+int reps = 5;
+string filter;
+bool generate_only = false;
+string reference_filename;
+string noisy_prefix;
+bool check_only = false;
+
+struct option options[] = {
+    {"lines",          required_argument, 0, 'n'},
+    {"vocab",          required_argument, 0, 'V'},
+    {"zipf",           required_argument, 0, 'z'},
+    {"mean_length",    required_argument, 0, 'l'},
+    {"max_length",     required_argument, 0, 'L'},
+    {"length_ratio",   required_argument, 0, 'R'},
+    {"noise",          required_argument, 0, 'e'},
+    {"seed",           required_argument, 0, 'S'},
+    {"reps",           required_argument, 0, 'r'},
+    {"filter",         required_argument, 0, 'f'},
+    {"generate",       no_argument,       0, 'g'},
+    {"reference",      required_argument, 0, 'a'},
+    {"noisy",          required_argument, 0, 'A'},
+    {"check",          no_argument,       0, 'c'},
+    {0,0,0,0}
+};
+
+bool InitCommandLine(int argc, char** argv) {
+  while (1) {
+    int oi;
+    int c = getopt_long(argc, argv, "n:V:z:l:L:R:e:S:r:f:ga:A:c", options, &oi);
+    if (c == -1) break;
+    switch(c) {
+      case 'n': num_lines = atoi(optarg); break;
+      case 'V': corpus_opts.vocab_size = atoi(optarg); break;
+      case 'z': corpus_opts.zipf_exponent = atof(optarg); break;
+      case 'l': corpus_opts.mean_length = atof(optarg); break;
+      case 'L': corpus_opts.max_length = atoi(optarg); break;
+      case 'R': corpus_opts.length_ratio = atof(optarg); break;
+      case 'e': corpus_opts.noise = atof(optarg); break;
+      case 'S': corpus_opts.seed = strtoull(optarg, NULL, 10); break;
+      case 'r': reps = atoi(optarg); break;
+      case 'f': filter = optarg; break;
+      case 'g': generate_only = true; break;
+      case 'a': reference_filename = optarg; break;
+      case 'A': noisy_prefix = optarg; break;
+      case 'c': check_only = true; break;
+      default: return false;
+    }
+  }
+  return num_lines > 0 && reps > 0 && corpus_opts.vocab_size > 0;
+}
+
+// runs f once to warm up, then reps times, and prints the median time
+template <class F>
+void Run(const string& name, double items, F f) {
+  if (!filter.empty() && name.find(filter) == string::npos) return;
+  f();
+  vector<double> times;
+  for (int r = 0; r < reps; ++r) {
+    Timer timer;
+    f();
+    times.push_back(timer.Elapsed());
+  }
+  sort(times.begin(), times.end());
+  const double median = times[times.size() / 2];
+  StatsRecord rec;
+  rec.Set("benchmark", name);
+  rec.Set("backend", kBackend);
+  rec.Set("items", items);
+  rec.Set("reps", reps);
+  rec.Set("median_seconds", median);
+  rec.Set("min_seconds", times.front());
+  rec.Set("items_per_second", items / median);
+  rec.Set("lines", num_lines);
+  rec.Set("vocab", corpus_opts.vocab_size);
+  rec.Set("zipf", corpus_opts.zipf_exponent);
+  rec.Set("mean_length", corpus_opts.mean_length);
+  rec.Set("length_ratio", corpus_opts.length_ratio);
+  rec.Set("seed", corpus_opts.seed);
+  rec.WriteJson(&cout, -1);
+  cout << endl;
+}
+
+struct Sentence {
+  vector<unsigned> src, trg;
+};
+
+// one counting pass of the E-step with NULL and the diagonal prior (the
+// default training path of fast_align)
+double EStep(const vector<Sentence>& corpus, const unsigned kNULL,
+             TTable* s2t) {
+  PosteriorOptions opts;
+  opts.kNULL = kNULL;
+  opts.prob_align_null = 0.08;
+  opts.diagonal_tension = 4.0;
+  PosteriorTotals totals;
+  double likelihood = 0;
+  vector<double> probs;
+  for (const Sentence& s : corpus)
+    likelihood += Posterior<true, true, false, false>::Run(
+        s.src, s.trg, 1.0, opts, s2t, &probs, &totals, NULL);
+  return likelihood;
+}
+
+// The model of fast_align written out plainly, cell by cell and with a map
+// for the table, for bench -c to check the Posterior variants and the
+// M-steps of TTable against
+struct ReferenceModel {
+  ReferenceModel(bool use_null, bool diagonal, const PosteriorOptions& opts)
+      : use_null(use_null), diagonal(diagonal), opts(opts), c0(), emp_feat() {}
+
+  // prior of source position i (1-based, 0 for NULL) for target word j,
+  // without the normalizer of the diagonal prior
+  double Prior(unsigned i, unsigned j, unsigned m, unsigned n) const {
+    if (!diagonal) return 1.0 / (n + use_null);
+    if (i == 0) return opts.prob_align_null;
+    return (1 - opts.prob_align_null) *
+        exp(-opts.diagonal_tension * fabs(double(i) / n - double(j + 1) / m));
+  }
+
+  // returns log p(trg | src) and sets (*cells)[j][i] to the joint
+  // probability of target word j and source position i (0 for NULL, which
+  // stays 0 without use_null); when counting, adds the posteriors to counts
+  double Run(const Sentence& s, bool count, vector<vector<double> >* cells) {
+    const unsigned n = s.src.size(), m = s.trg.size();
+    cells->assign(m, vector<double>(n + 1, 0.0));
+    double likelihood = 0;
+    for (unsigned j = 0; j < m; ++j) {
+      vector<double>& p = (*cells)[j];
+      double z = 0;
+      for (unsigned i = 1; i <= n; ++i) z += Prior(i, j, m, n);
+      z = diagonal ? z / (1 - opts.prob_align_null) : 1;
+      double sum = 0;
+      for (unsigned i = !use_null; i <= n; ++i) {
+        const unsigned e = i ? s.src[i - 1] : opts.kNULL;
+        p[i] = t[make_pair(e, s.trg[j])] * Prior(i, j, m, n) / (i ? z : 1);
+        sum += p[i];
+      }
+      likelihood += log(sum);
+      if (!count) continue;
+      for (unsigned i = !use_null; i <= n; ++i) {
+        const unsigned e = i ? s.src[i - 1] : opts.kNULL;
+        counts[make_pair(e, s.trg[j])] += p[i] / sum;
+        if (i)
+          emp_feat -= fabs(double(i) / n - double(j) / m) * p[i] / sum;
+        else
+          c0 += p[i] / sum;
+      }
+    }
+    return likelihood;
+  }
+
+  static double Digamma(double x) {
+    double r = 0;
+    for (; x < 10; ++x) r -= 1 / x;
+    const double x2 = 1 / (x * x);
+    return r + log(x) - 0.5 / x -
+        x2 * (1.0 / 12 - x2 * (1.0 / 120 - x2 * (1.0 / 252 - x2 / 240)));
+  }
+
+  // t(f | e) = c(e, f) / c(e), or with VB exp(digamma(c(e, f) + alpha) -
+  // digamma(c(e) + alpha per entry)); the counts start over
+  void Normalize(bool vb, double alpha) {
+    map<unsigned, double> totals;
+    for (auto& c : counts) totals[c.first.first] += c.second + (vb ? alpha : 0);
+    for (auto& c : counts) {
+      const double tot = totals[c.first.first] ? totals[c.first.first] : 1;
+      t[c.first] = vb ? exp(Digamma(c.second + alpha) - Digamma(tot))
+                      : c.second / tot;
+      c.second = 0;
+    }
+    c0 = emp_feat = 0;
+  }
+
+  bool use_null, diagonal;
+  PosteriorOptions opts;
+  map<pair<unsigned, unsigned>, double> t, counts;
+  double c0, emp_feat;
+};
+
+// largest relative difference seen, and the number over the tolerance
+struct Discrepancy {
+  Discrepancy(double tolerance) : tolerance(tolerance), max_error(), errors() {}
+  void Check(double got, double want) {
+    const double err = fabs(got - want) / max(1.0, fabs(want));
+    max_error = max(max_error, err);
+    if (!(err <= tolerance)) ++errors;
+  }
+  double tolerance, max_error;
+  unsigned errors;
+};
+
+// the links must be the best cells of the reference up to rounding (ties
+// may go either way)
+void CheckLinks(const vector<unsigned>& links,
+                const vector<vector<double> >& cells, Discrepancy* d) {
+  for (unsigned j = 0; j < cells.size(); ++j) {
+    const vector<double>& p = cells[j];
+    const double best = *max_element(p.begin(), p.end());
+    d->Check(p[links[j]], best);
+  }
+}
+
+// runs a few EM iterations with every Posterior variant next to the
+// reference, then decodes; returns the number of mismatches
+unsigned CheckPosterior(const vector<Sentence>& corpus, unsigned kNULL) {
+  const int kIterations = 3;
+  const double kAlpha = 0.01;
+  unsigned failures = 0;
+  for (int v = 0; v < 8; ++v) {
+    const bool use_null = v & 4, diagonal = v & 2, vb = v & 1;
+    PosteriorOptions opts;
+    opts.kNULL = kNULL;
+    opts.prob_align_null = 0.08;
+    opts.diagonal_tension = 4.0;
+    ReferenceModel ref(use_null, diagonal, opts);
+    TTable s2t;
+    for (const Sentence& s : corpus) {
+      for (unsigned f : s.trg) {
+        if (use_null) s2t.Insert(kNULL, f);
+        for (unsigned e : s.src) s2t.Insert(e, f);
+      }
+    }
+    s2t.Freeze();
+    for (const Sentence& s : corpus) {
+      for (unsigned f : s.trg) {
+        if (use_null) ref.t[make_pair(kNULL, f)] = s2t.prob(kNULL, f);
+        for (unsigned e : s.src) ref.t[make_pair(e, f)] = s2t.prob(e, f);
+      }
+    }
+    // the M-step of VB goes through the vectorized digamma
+    Discrepancy likelihood(1e-9), totals(1e-9), params(vb ? 1e-8 : 1e-9),
+        links(1e-9), band(1e-9);
+    vector<double> probs;
+    vector<unsigned> viterbi;
+    vector<vector<double> > cells;
+    const PosteriorFn count = SelectPosterior(use_null, diagonal, false, false);
+    for (int it = 0; it < kIterations; ++it) {
+      PosteriorTotals tot;
+      for (const Sentence& s : corpus) {
+        const double got = count(s.src, s.trg, 1.0, opts, &s2t, &probs, &tot,
+                                 &viterbi);
+        likelihood.Check(got, ref.Run(s, true, &cells));
+        CheckLinks(viterbi, cells, &links);
+      }
+      if (use_null) totals.Check(tot.c0, ref.c0);
+      if (diagonal) totals.Check(tot.emp_feat, ref.emp_feat);
+      if (vb)
+        s2t.NormalizeVB(kAlpha);
+      else
+        s2t.Normalize();
+      ref.Normalize(vb, kAlpha);
+      for (auto& p : ref.t)
+        params.Check(s2t.prob(p.first.first, p.first.second), p.second);
+    }
+    // decoding, with prob and with safe_prob
+    for (int safe = 0; safe < 2; ++safe) {
+      const PosteriorFn decode = SelectPosterior(use_null, diagonal, true, safe);
+      for (const Sentence& s : corpus) {
+        const double got = decode(s.src, s.trg, 1.0, opts, &s2t, &probs, NULL,
+                                  &viterbi);
+        likelihood.Check(got, ref.Run(s, false, &cells));
+        CheckLinks(viterbi, cells, &links);
+      }
+    }
+    // the band leaves out at most band_epsilon of the prior mass of each
+    // target word, so the likelihood may drop by up to -log(1 - epsilon)
+    if (diagonal) {
+      opts.band_epsilon = 1e-4;
+      const PosteriorFn decode = SelectPosterior(use_null, diagonal, true, false);
+      for (const Sentence& s : corpus) {
+        const double got = decode(s.src, s.trg, 1.0, opts, &s2t, &probs, NULL,
+                                  &viterbi);
+        const double want = ref.Run(s, false, &cells);
+        const double slack = -log(1 - opts.band_epsilon) * s.trg.size();
+        // a drop within the slack counts as none
+        band.Check(got < want && got >= want - slack ? want : got, want);
+      }
+    }
+    const unsigned errors = likelihood.errors + totals.errors + params.errors +
+        links.errors + band.errors;
+    failures += errors;
+    StatsRecord rec;
+    rec.Set("check", string("posterior") + (use_null ? "_null" : "") +
+            (diagonal ? "_diagonal" : "") + (vb ? "_vb" : ""));
+    rec.Set("lines", corpus.size());
+    rec.Set("entries", s2t.num_entries());
+    rec.Set("likelihood_error", likelihood.max_error);
+    rec.Set("totals_error", totals.max_error);
+    rec.Set("params_error", params.max_error);
+    rec.Set("links_error", links.max_error);
+    rec.Set("band_error", band.max_error);
+    rec.Set("mismatches", errors);
+    rec.WriteJson(&cout, -1);
+    cout << endl;
+  }
+  return failures;
+}
+
+string ToPharaoh(const vector<pair<unsigned, unsigned> >& links) {
+  ostringstream os;
+  for (unsigned k = 0; k < links.size(); ++k)
+    os << (k ? " " : "") << links[k].first << '-' << links[k].second;
+  return os.str();
+}
+
+// two noisy copies of a reference alignment, each keeping 90% of its
+// links, standing in for the forward and reverse outputs of fast_align
+void NoisyCopies(const vector<pair<unsigned, unsigned> >& links,
+                 SyntheticCorpus* gen, string* fwd_al, string* rev_al) {
+  vector<pair<unsigned, unsigned> > fwd, rev;
+  for (unsigned l = 0; l < links.size(); ++l) {
+    if (gen->Uniform() < 0.9) fwd.push_back(links[l]);
+    if (gen->Uniform() < 0.9) rev.push_back(links[l]);
+  }
+  *fwd_al = ToPharaoh(fwd);
+  *rev_al = ToPharaoh(rev);
+}
+
+int main(int argc, char** argv) {
+  if (!InitCommandLine(argc, argv)) {
+    cerr << "Usage: " << argv[0] << " [options]\n"
+         << "  -g: write the synthetic corpus to stdout instead of benchmarking\n"
+         << "  -a FILE: with -g, write the alignments the corpus was generated\n"
+         << "      from to FILE (source-target, to score fast_align against)\n"
+         << "  -A PREFIX: with -g, write the two noisy copies of them that the\n"
+         << "      atools benchmarks symmetrize to PREFIX.fwd and PREFIX.rev (the\n"
+         << "      corpus is then the one the benchmarks use)\n"
+         << "  -c: check every posterior variant and both M-steps against a\n"
+         << "      plain reference implementation instead of benchmarking\n"
+         << "  -n: number of sentence pairs (default = 20000)\n"
+         << "  -V: vocabulary size per language (default = 50000)\n"
+         << "  -z: Zipf exponent of the word distribution (default = 1)\n"
+         << "  -l: mean source sentence length (default = 20)\n"
+         << "  -L: maximum sentence length (default = 100)\n"
+         << "  -R: expected target / source length ratio (default = 1)\n"
+         << "  -e: probability of an untranslated target word (default = 0.2)\n"
+         << "  -S: random seed (default = 1)\n"
+         << "  -r: timed repetitions per benchmark (default = 5)\n"
+         << "  -f: only run benchmarks whose name contains this string\n";
+    return 1;
+  }
+  SyntheticCorpus gen(corpus_opts);
+  if (generate_only) {
+    ofstream reference, fwd, rev;
+    if (!reference_filename.empty()) {
+      reference.open(reference_filename.c_str());
+      if (!reference) {
+        cerr << "can't write " << reference_filename << endl;
+        return 1;
+      }
+    }
+    if (!noisy_prefix.empty()) {
+      fwd.open((noisy_prefix + ".fwd").c_str());
+      rev.open((noisy_prefix + ".rev").c_str());
+      if (!fwd || !rev) {
+        cerr << "can't write " << noisy_prefix << ".fwd/.rev" << endl;
+        return 1;
+      }
+    }
+    vector<unsigned> src, trg;
+    vector<pair<unsigned, unsigned> > links;
+    string fwd_al, rev_al;
+    for (int k = 0; k < num_lines; ++k) {
+      gen.NextPair(&src, &trg, &links);
+      cout << SyntheticCorpus::FormatLine(src, trg) << '\n';
+      if (reference.is_open()) reference << ToPharaoh(links) << '\n';
+      if (fwd.is_open()) {
+        NoisyCopies(links, &gen, &fwd_al, &rev_al);
+        fwd << fwd_al << '\n';
+        rev << rev_al << '\n';
+      }
+    }
+    return 0;
+  }
+
+  // corpus as text, ids, and the noisy copies of the reference alignment
+  vector<string> lines(num_lines);
+  vector<string> fwd_al(num_lines), rev_al(num_lines);
+  {
+    vector<unsigned> src, trg;
+    vector<pair<unsigned, unsigned> > links;
+    for (int k = 0; k < num_lines; ++k) {
+      gen.NextPair(&src, &trg, &links);
+      lines[k] = SyntheticCorpus::FormatLine(src, trg);
+      NoisyCopies(links, &gen, &fwd_al[k], &rev_al[k]);
+    }
+  }
+
+  Dict d;
+  const unsigned kDIV = d.Convert("|||");
+  const unsigned kNULL = d.Convert("<eps>");
+  vector<Sentence> corpus(num_lines);
+  double tokens = 0;
+  double cells = 0;
+  map<pair<unsigned, unsigned>, unsigned> length_pairs;
+  {
+    vector<unsigned> tmp;
+    for (int k = 0; k < num_lines; ++k) {
+      d.ConvertWhitespaceDelimitedLine(lines[k], kDIV, &tmp);
+      Sentence& s = corpus[k];
+      vector<unsigned>::iterator div = find(tmp.begin(), tmp.end(), kDIV);
+      s.src.assign(tmp.begin(), div);
+      s.trg.assign(div + 1, tmp.end());
+      tokens += tmp.size() - 1;
+      cells += (s.src.size() + 1) * s.trg.size();
+      ++length_pairs[make_pair(s.trg.size(), s.src.size())];
+    }
+  }
+
+  if (check_only) return CheckPosterior(corpus, kNULL) ? 1 : 0;
+
+  TTable s2t;
+  for (const Sentence& s : corpus) {
+    for (unsigned f : s.trg) s2t.Insert(kNULL, f);
+    for (unsigned e : s.src)
+      for (unsigned f : s.trg) s2t.Insert(e, f);
+  }
+  s2t.Freeze();
+  EStep(corpus, kNULL, &s2t);
+  s2t.Normalize();
+  const double entries = s2t.num_entries();
+
+  Run("dict_convert_new", tokens, [&]() {
+    Dict fresh;
+    vector<unsigned> tmp;
+    for (const string& line : lines)
+      fresh.ConvertWhitespaceDelimitedLine(line, 1, &tmp);
+  });
+  Run("dict_convert_known", tokens, [&]() {
+    vector<unsigned> tmp;
+    for (const string& line : lines)
+      d.ConvertWhitespaceDelimitedLine(line, kDIV, &tmp);
+  });
+
+  volatile double sink = 0;
+  Run("ttable_prob", cells, [&]() {
+    double x = 0;
+    for (const Sentence& s : corpus)
+      for (unsigned f : s.trg) {
+        x += s2t.prob(kNULL, f);
+        for (unsigned e : s.src) x += s2t.prob(e, f);
+      }
+    sink = x;
+  });
+  Run("ttable_increment", cells, [&]() {
+    for (const Sentence& s : corpus)
+      for (unsigned f : s.trg) {
+        s2t.Increment(kNULL, f, 1e-3);
+        for (unsigned e : s.src) s2t.Increment(e, f, 1e-3);
+      }
+  });
+  Run("ttable_normalize", entries, [&]() { s2t.Normalize(); });
+  Run("ttable_normalize_vb", entries, [&]() { s2t.NormalizeVB(0.01); });
+  // the benchmarks above leave counts of 0 (or uniform values) behind;
+  // restore a trained table for the E-step
+  EStep(corpus, kNULL, &s2t);
+  s2t.Normalize();
+
+  double num_z = 0;
+  for (auto& lp : length_pairs) num_z += lp.first.first;
+  Run("diagonal_compute_z", num_z, [&]() {
+    double x = 0;
+    for (auto& lp : length_pairs)
+      for (unsigned j = 1; j <= lp.first.first; ++j)
+        x += DiagonalAlignment::ComputeZ(j, lp.first.first, lp.first.second, 4.0);
+    sink = x;
+  });
+  Run("diagonal_compute_dlogz", num_z, [&]() {
+    double x = 0;
+    for (auto& lp : length_pairs)
+      for (unsigned j = 1; j <= lp.first.first; ++j)
+        x += DiagonalAlignment::ComputeDLogZ(j, lp.first.first, lp.first.second, 4.0);
+    sink = x;
+  });
+  Run("estep", num_lines, [&]() { sink = EStep(corpus, kNULL, &s2t); });
+
+  // the lookups of forced alignment, in the trained table and in its
+  // compact (8-bit, mapped) form
+  Run("ttable_safe_prob", cells, [&]() {
+    double x = 0;
+    for (const Sentence& s : corpus)
+      for (unsigned f : s.trg) {
+        x += s2t.safe_prob(kNULL, f);
+        for (unsigned e : s.src) x += s2t.safe_prob(e, f);
+      }
+    sink = x;
+  });
+  char compact_file[] = "/tmp/bench_compactXXXXXX";
+  const int fd = mkstemp(compact_file);
+  if (fd >= 0) {
+    close(fd);
+    CompactTTable compact;
+    Dict compact_dict;
+    if (CompactTTable::Write(s2t, d, -4.0, 8, compact_file) &&
+        compact.Open(compact_file, &compact_dict)) {
+      // the compact model numbers its words anew
+      vector<Sentence> compact_corpus(corpus);
+      for (Sentence& s : compact_corpus) {
+        for (unsigned& e : s.src) e = compact_dict.Lookup(d.Convert(e));
+        for (unsigned& f : s.trg) f = compact_dict.Lookup(d.Convert(f));
+      }
+      const unsigned compact_null = compact_dict.Lookup(d.Convert(kNULL));
+      Run("compact_safe_prob", cells, [&]() {
+        double x = 0;
+        for (const Sentence& s : compact_corpus)
+          for (unsigned f : s.trg) {
+            x += compact.safe_prob(compact_null, f);
+            for (unsigned e : s.src) x += compact.safe_prob(e, f);
+          }
+        sink = x;
+      });
+    }
+    unlink(compact_file);
+  }
+
+  vector<Alignment> fwd_links(num_lines), rev_links(num_lines);
+  for (int k = 0; k < num_lines; ++k) {
+    AlignmentIO::ReadPharaohAlignment(fwd_al[k], &fwd_links[k]);
+    AlignmentIO::ReadPharaohAlignment(rev_al[k], &rev_links[k]);
+  }
+  Run("atools_read_pharaoh", num_lines, [&]() {
+    Alignment a;
+    for (const string& al : fwd_al)
+      AlignmentIO::ReadPharaohAlignment(al, &a);
+  });
+  Run("atools_write_pharaoh", num_lines, [&]() {
+    ostringstream os;
+    for (int k = 0; k < num_lines; ++k)
+      AlignmentIO::SerializePharaohFormat(fwd_links[k], &os);
+  });
+  // every command except display, which only prints
+  vector<shared_ptr<Command> > commands;
+  commands.push_back(make_shared<ConvertCommand>());
+  commands.push_back(make_shared<InvertCommand>());
+  commands.push_back(make_shared<IntersectCommand>());
+  commands.push_back(make_shared<UnionCommand>());
+  commands.push_back(make_shared<GDCommand>());
+  commands.push_back(make_shared<GDFCommand>());
+  commands.push_back(make_shared<GDFACommand>());
+  commands.push_back(make_shared<FMeasureCommand>());
+  for (shared_ptr<Command>& cmd : commands) {
+    Run("atools_" + cmd->Name(), num_lines, [&]() {
+      Alignment out, dummy;
+      for (int k = 0; k < num_lines; ++k)
+        cmd->Apply(fwd_links[k], cmd->RequiresTwoOperands() ? rev_links[k] : dummy, &out);
+    });
+  }
+  return 0;
+}
@@ -0,0 +1,213 @@
+#include "src/compact_ttable.h"
+
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "src/ttables.h"
+
+using namespace std;
+
+const char CompactTTable::kMagic[9] = "\x89" "FACOMP\n";
+
+namespace {
+
+size_t Padded(size_t bytes) { return (bytes + 7) / 8 * 8; }
+
+void Append(const void* data, size_t bytes, string* out) {
+  out->append(static_cast<const char*>(data), bytes);
+  out->append(Padded(bytes) - bytes, '\0');
+}
+
+// adds the padded size of n items of size bytes to *total; false if that
+// doesn't fit in a size_t (a corrupt count)
+bool AddSection(uint64_t n, size_t size, size_t* total) {
+  if (n > (SIZE_MAX - 7) / size) return false;
+  const size_t bytes = Padded(n * size);
+  if (bytes > SIZE_MAX - *total) return false;
+  *total += bytes;
+  return true;
+}
+
+}  // namespace
+
+bool CompactTTable::IsCompact(const string& filename) {
+  ifstream in(filename.c_str(), ios::binary);
+  char magic[8];
+  return in.read(magic, 8) && memcmp(magic, kMagic, 8) == 0;
+}
+
+bool CompactTTable::Write(const TTable& t, const Dict& d,
+                          double beam_threshold, int bits,
+                          const string& filename) {
+  ofstream out(filename.c_str(), ios::binary);
+  if (!out) return false;
+  // Only the words of the parameters are kept, numbered in the order
+  // TTable::DeserializeLogProbsFromText would number them, after the
+  // NULL word and the separator of Aligner. Count the entries of each row,
+  // then place them.
+  Dict words;
+  words.Convert("<eps>");
+  words.Convert("|||");
+  vector<unsigned> id(d.max() + 1, 0);
+  auto renumber = [&](unsigned w) {
+    if (!id[w]) id[w] = words.Convert(d.Convert(w));
+    return id[w];
+  };
+  vector<uint64_t> start(1, 0);
+  t.ForEachExported(beam_threshold, [&](unsigned e, unsigned f, double c) {
+    if (!std::isfinite(c)) return;  // probability 0: left to the floor
+    e = renumber(e);
+    renumber(f);
+    if (e + 2 > start.size()) start.resize(e + 2, 0);
+    ++start[e + 1];
+  });
+  const size_t rows = start.size() - 1;
+  for (size_t e = 0; e < rows; ++e)
+    start[e + 1] += start[e];
+  const size_t entries = start[rows];
+  vector<pair<uint32_t, double> > row_entries(entries);
+  vector<uint64_t> cur(start.begin(), start.end() - 1);
+  t.ForEachExported(beam_threshold, [&](unsigned e, unsigned f, double c) {
+    if (std::isfinite(c)) row_entries[cur[id[e]]++] = make_pair(id[f], c);
+  });
+  vector<float> scale(2 * rows);
+  vector<uint32_t> target(entries);
+  vector<uint8_t> q8(bits == 8 ? entries : 0);
+  vector<uint16_t> q16(bits == 8 ? 0 : entries);
+  const double levels = (1 << bits) - 1;
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (long e = 0; e < static_cast<long>(rows); ++e) {
+    if (start[e] == start[e + 1]) continue;
+    pair<uint32_t, double>* first = &row_entries[start[e]];
+    pair<uint32_t, double>* last = first + (start[e + 1] - start[e]);
+    sort(first, last);
+    double lo = first->second, hi = first->second;
+    for (pair<uint32_t, double>* it = first; it != last; ++it) {
+      lo = min(lo, it->second);
+      hi = max(hi, it->second);
+    }
+    // quantize against the stored (float) scale
+    const float lo_f = lo;
+    const float step_f = (hi - lo) / levels;
+    scale[2 * e] = lo_f;
+    scale[2 * e + 1] = step_f;
+    for (pair<uint32_t, double>* it = first; it != last; ++it) {
+      const size_t k = it - &row_entries[0];
+      double q = step_f > 0 ? floor((it->second - lo_f) / step_f + 0.5) : 0;
+      q = max(0.0, min(levels, q));
+      target[k] = it->first;
+      if (bits == 8)
+        q8[k] = q;
+      else
+        q16[k] = q;
+    }
+  }
+  vector<pair<uint32_t, double> >().swap(row_entries);
+
+  Header h;
+  memcpy(h.magic, kMagic, 8);
+  h.bits = bits;
+  h.reserved = 0;
+  h.rows = rows;
+  h.entries = entries;
+  string blob;
+  Append(&h, sizeof(h), &blob);
+  words.SerializeToBlob(&blob);
+  out.write(blob.data(), blob.size());
+  blob.clear();
+  Append(&start[0], start.size() * sizeof(uint64_t), &blob);
+  if (rows) Append(&scale[0], scale.size() * sizeof(float), &blob);
+  out.write(blob.data(), blob.size());
+  blob.clear();
+  if (entries) {
+    Append(&target[0], entries * sizeof(uint32_t), &blob);
+    if (bits == 8)
+      Append(&q8[0], entries, &blob);
+    else
+      Append(&q16[0], entries * sizeof(uint16_t), &blob);
+  }
+  out.write(blob.data(), blob.size());
+  return static_cast<bool>(out);
+}
+
+bool CompactTTable::Open(const string& filename, Dict* d) {
+  Close();
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void* p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+      st.st_size >= static_cast<off_t>(sizeof(Header)))
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return false;
+  madvise(p, st.st_size, MADV_WILLNEED);
+  data_ = static_cast<const char*>(p);
+  size_ = st.st_size;
+  Header h;
+  memcpy(&h, data_, sizeof(h));
+  const size_t dict_bytes = memcmp(h.magic, kMagic, 8) == 0 &&
+      (h.bits == 8 || h.bits == 16) ?
+      d->InitFromBlob(data_ + sizeof(h), size_ - sizeof(h)) : 0;
+  if (!dict_bytes) {
+    Close();
+    return false;
+  }
+  const char* pos = data_ + sizeof(h) + dict_bytes;
+  size_t needed = sizeof(h) + dict_bytes;
+  if (h.rows == UINT64_MAX ||
+      !AddSection(h.rows + 1, sizeof(uint64_t), &needed) ||
+      !AddSection(h.rows, 2 * sizeof(float), &needed) ||
+      !AddSection(h.entries, sizeof(uint32_t), &needed) ||
+      !AddSection(h.entries, h.bits / 8, &needed) || needed > size_) {
+    *d = Dict();
+    Close();
+    return false;
+  }
+  bits_ = h.bits;
+  rows_ = h.rows;
+  entries_ = h.entries;
+  start_ = reinterpret_cast<const uint64_t*>(pos);
+  pos += Padded((rows_ + 1) * sizeof(uint64_t));
+  scale_ = reinterpret_cast<const float*>(pos);
+  pos += Padded(2 * rows_ * sizeof(float));
+  target_ = reinterpret_cast<const uint32_t*>(pos);
+  pos += Padded(entries_ * sizeof(uint32_t));
+  if (bits_ == 8)
+    q8_ = reinterpret_cast<const uint8_t*>(pos);
+  else
+    q16_ = reinterpret_cast<const uint16_t*>(pos);
+  // safe_prob trusts the rows to lie within the entries and the target
+  // ids to be words of the vocabulary, so check them once here
+  bool ok = start_[rows_] == entries_;
+  for (size_t e = 0; ok && e < rows_; ++e)
+    ok = start_[e] <= start_[e + 1];
+  for (size_t k = 0; ok && k < entries_; ++k)
+    ok = target_[k] <= d->max();
+  if (!ok) {
+    *d = Dict();
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void CompactTTable::Close() {
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+  data_ = NULL;
+  size_ = 0;
+  bits_ = 0;
+  rows_ = entries_ = 0;
+  start_ = NULL;
+  scale_ = NULL;
+  target_ = NULL;
+  q8_ = NULL;
+  q16_ = NULL;
+}
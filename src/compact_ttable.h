@@ -0,0 +1,95 @@
+#ifndef COMPACT_TTABLE_H_
+#define COMPACT_TTABLE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <stdint.h>
+
+#include "src/corpus.h"
+
+class TTable;
+
+// Read-only translation table for forced alignment, memory-mapped from a
+// compact model file: per source word, the sorted ids of its target words
+// and their log probabilities quantized to 8 or 16 bits on a per-row scale,
+// log p = lo + q * step. Lookups binary-search the row. The file holds the
+// vocabulary as well and is used in place, so processes aligning with the
+// same model share its pages.
+//
+// File layout (host byte order, every section padded to 8 bytes):
+//   header   8 magic bytes ("\x89FACOMP\n"), uint32 bits, uint32 0,
+//            uint64 rows, uint64 entries
+//   vocabulary as written by Dict::SerializeToBlob
+//   uint64   start[rows + 1]     entries of row e are [start[e], start[e+1])
+//   float    scale[2 * rows]     lo and step of each row
+//   uint32   target[entries]
+//   uint8 or uint16 q[entries]
+class CompactTTable {
+ public:
+  static const char kMagic[9];
+
+  CompactTTable()
+      : data_(NULL), size_(0), bits_(0), rows_(0), entries_(0), start_(NULL),
+        scale_(NULL), target_(NULL), q8_(NULL), q16_(NULL) {}
+  ~CompactTTable() { Close(); }
+
+  // true if filename starts like a compact model
+  static bool IsCompact(const std::string& filename);
+  // writes the parameters t.ExportToFile would write, quantized to bits (8
+  // or 16), with the words of d they use; false if the file can't be
+  // written
+  static bool Write(const TTable& t, const Dict& d, double beam_threshold,
+                    int bits, const std::string& filename);
+
+  // maps filename and makes *d a view of its vocabulary (valid until
+  // Close); false if it can't be read or isn't a compact model
+  bool Open(const std::string& filename, Dict* d);
+  void Close();
+
+  bool empty() const { return data_ == NULL; }
+  int bits() const { return bits_; }
+  size_t num_entries() const { return entries_; }
+  // bytes of the table in the file, without the vocabulary
+  size_t memory_bytes() const {
+    return (rows_ + 1) * sizeof(uint64_t) + 2 * rows_ * sizeof(float) +
+        entries_ * (sizeof(uint32_t) + bits_ / 8);
+  }
+
+  inline double safe_prob(unsigned e, unsigned f) const {
+    if (e >= rows_) return 1e-9;
+    const uint32_t* first = target_ + start_[e];
+    const uint32_t* last = target_ + start_[e + 1];
+    const uint32_t* it = std::lower_bound(first, last, f);
+    if (it == last || *it != f) return 1e-9;
+    const size_t k = it - target_;
+    const unsigned q = q8_ ? q8_[k] : q16_[k];
+    return std::exp(scale_[2 * e] + q * scale_[2 * e + 1]);
+  }
+  // every lookup is safe
+  inline double prob(unsigned e, unsigned f) const { return safe_prob(e, f); }
+
+ private:
+  struct Header {
+    char magic[8];
+    uint32_t bits;
+    uint32_t reserved;
+    uint64_t rows;
+    uint64_t entries;
+  };
+  CompactTTable(const CompactTTable&);
+  void operator=(const CompactTTable&);
+
+  const char* data_;
+  size_t size_;
+  int bits_;
+  size_t rows_;
+  size_t entries_;
+  const uint64_t* start_;
+  const float* scale_;
+  const uint32_t* target_;
+  const uint8_t* q8_;
+  const uint16_t* q16_;
+};
+
+#endif
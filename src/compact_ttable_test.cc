@@ -0,0 +1,143 @@
+// Checks that CompactTTable reads back what it writes, and that Open
+// rejects truncated and corrupt files instead of mapping them: every
+// truncation of a model, row and entry counts whose sizes overflow, row
+// starts that go backwards and target ids outside the vocabulary.
+//
+//   compact_ttable_test [file]    exit status 1 on a failure
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "src/compact_ttable.h"
+#include "src/corpus.h"
+#include "src/ttables.h"
+
+using namespace std;
+
+unsigned failures = 0;
+
+void Expect(bool ok, const string& what) {
+  cout << what << ": " << (ok ? "ok" : "FAILED") << endl;
+  if (!ok) ++failures;
+}
+
+string ReadFile(const string& filename) {
+  ifstream in(filename.c_str(), ios::binary);
+  return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+void WriteFile(const string& filename, const string& bytes) {
+  ofstream out(filename.c_str(), ios::binary | ios::trunc);
+  out.write(bytes.data(), bytes.size());
+}
+
+// true if Open rejects bytes, and leaves the vocabulary empty
+bool Rejects(const string& filename, const string& bytes) {
+  WriteFile(filename, bytes);
+  CompactTTable t;
+  Dict d;
+  return !t.Open(filename, &d) && t.empty() && d.max() == 0;
+}
+
+uint64_t Get64(const string& bytes, size_t offset) {
+  uint64_t x;
+  memcpy(&x, bytes.data() + offset, sizeof(x));
+  return x;
+}
+
+string Put64(string bytes, size_t offset, uint64_t x) {
+  memcpy(&bytes[offset], &x, sizeof(x));
+  return bytes;
+}
+
+string Put32(string bytes, size_t offset, uint32_t x) {
+  memcpy(&bytes[offset], &x, sizeof(x));
+  return bytes;
+}
+
+size_t Padded(size_t bytes) { return (bytes + 7) / 8 * 8; }
+
+int main(int argc, char** argv) {
+  const string filename = argc > 1 ? argv[1] : "compact_ttable_test.fac";
+  // a few rows of different lengths, so that the row starts differ
+  Dict d;
+  d.Convert("<eps>");
+  d.Convert("|||");
+  vector<unsigned> src, trg;
+  for (int k = 0; k < 4; ++k)
+    src.push_back(d.Convert("e" + to_string(k)));
+  for (int k = 0; k < 6; ++k)
+    trg.push_back(d.Convert("f" + to_string(k)));
+  TTable s2t;
+  for (unsigned e = 0; e < src.size(); ++e)
+    for (unsigned f = 0; f <= e + 1; ++f)
+      s2t.Insert(src[e], trg[f]);
+  s2t.Freeze();
+  for (unsigned e = 0; e < src.size(); ++e)
+    for (unsigned f = 0; f <= e + 1; ++f)
+      s2t.Increment(src[e], trg[f], 1.0 + f);
+  s2t.Normalize();
+
+  Expect(CompactTTable::Write(s2t, d, -1000, 16, filename), "compact_write");
+  const string good = ReadFile(filename);
+  {
+    CompactTTable t;
+    Dict words;
+    bool same = t.Open(filename, &words) && t.num_entries() == 14;
+    for (unsigned e = 0; same && e < src.size(); ++e) {
+      const unsigned ce = words.Lookup(d.Convert(src[e]));
+      for (unsigned f = 0; same && f < trg.size(); ++f) {
+        const unsigned cf = words.Lookup(d.Convert(trg[f]));
+        const double want = f <= e + 1 ? s2t.prob(src[e], trg[f]) : 1e-9;
+        same = fabs(t.safe_prob(ce, cf) - want) <= 1e-3 * want;
+      }
+    }
+    Expect(same, "compact_round_trip");
+  }
+
+  bool truncated = true;
+  for (size_t n = 0; n < good.size(); ++n)
+    truncated = truncated && Rejects(filename, good.substr(0, n));
+  Expect(truncated, "compact_truncated");
+
+  // the header: magic, bits, reserved, rows, entries
+  const uint64_t rows = Get64(good, 16);
+  const uint64_t entries = Get64(good, 24);
+  // rows + 2^61 wraps around to the same section sizes and the same last
+  // row start
+  Expect(Rejects(filename, Put64(good, 16, UINT64_MAX)) &&
+         Rejects(filename, Put64(good, 16, rows + (uint64_t(1) << 61))) &&
+         Rejects(filename, Put64(good, 24, uint64_t(1) << 62)),
+         "compact_overflowing_counts");
+
+  // the sections after the vocabulary, found from the end of the file
+  const size_t target = good.size() - Padded(entries * 2) -
+      Padded(entries * 4);
+  const size_t start = target - Padded(rows * 8) - Padded((rows + 1) * 8);
+  bool backwards = false;
+  for (uint64_t e = 1; !backwards && e < rows; ++e) {
+    if (Get64(good, start + 8 * e) == Get64(good, start + 8 * (e + 1)))
+      continue;
+    // row e - 1 ends after row e
+    backwards = Rejects(filename, Put64(good, start + 8 * e,
+                                        Get64(good, start + 8 * (e + 1)) + 1));
+  }
+  Expect(backwards, "compact_row_starts_backwards");
+  Expect(Rejects(filename, Put64(good, start + 8 * rows, entries - 1)),
+         "compact_row_starts_short");
+  Expect(Rejects(filename, Put32(good, target, 1000)) &&
+         Rejects(filename, Put32(good, target + 4 * (entries - 1),
+                                 UINT32_MAX)),
+         "compact_target_outside_vocabulary");
+
+  // and the untouched file still opens
+  Expect(!Rejects(filename, good), "compact_reopen");
+  remove(filename.c_str());
+  return failures ? 1 : 0;
+}
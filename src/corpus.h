@@ -2,39 +2,84 @@
 #define CPYPDICT_H_
 
 #include <string>
+#include <cstring>
 #include <iostream>
 #include <cassert>
 #include <fstream>
 #include <vector>
 #include <set>
-#include "src/hashtables.h"
+#include <stdint.h>
 #include "src/port.h"
 
+// non-owning reference to a range of characters, e.g. a line or a token
+// inside a memory-mapped corpus
+struct StringPiece {
+  StringPiece() : data(NULL), size(0) {}
+  StringPiece(const char* d, size_t s) : data(d), size(s) {}
+  StringPiece(const std::string& s) : data(s.data()), size(s.size()) {}
+  std::string str() const { return std::string(data, size); }
+  bool empty() const { return size == 0; }
+  const char* data;
+  size_t size;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const StringPiece& s) {
+  return os.write(s.data, s.size);
+}
+
+// Vocabulary. All word bytes live in one contiguous arena; word id k (k > 0)
+// spans [offsets[k-1], offsets[k]) of it. Lookups go through a flat,
+// linearly probed table of (hash, id) slots, so a probe only touches the
+// arena when the stored 32-bit hashes agree. The three arrays can be written
+// out as one blob and later used in place (e.g. straight from an mmap'd
+// model file); such a view is read-only until the first insertion, which
+// copies it.
 class Dict {
  public:
   Dict() : b0_("<bad0>") {
-    words_.reserve(1000);
+    offsets_.reserve(1000);
+    offsets_.push_back(0);
+    table_.resize(1024);
+    SyncViews();
+  }
+  Dict(const Dict& rhs) :
+      b0_(rhs.b0_), arena_(rhs.bytes_, rhs.bytes_ + rhs.offs_[rhs.size_]),
+      offsets_(rhs.offs_, rhs.offs_ + rhs.size_ + 1),
+      table_(rhs.slots_, rhs.slots_ + rhs.mask_ + 1) {
+    SyncViews();
+  }
+  const Dict& operator=(const Dict& rhs) {
+    Dict tmp(rhs);
+    arena_.swap(tmp.arena_);
+    offsets_.swap(tmp.offsets_);
+    table_.swap(tmp.table_);
+    SyncViews();
+    return *this;
   }
 
-  inline unsigned max() const { return words_.size(); }
+  inline unsigned max() const { return size_; }
 
   static bool is_ws(char x) {
     return (x == ' ' || x == '\t');
   }
 
+  // with frozen, words not in the dictionary get id 0 instead of being
+  // added (see Convert)
   inline void ConvertWhitespaceDelimitedLine(
-      const std::string& line,
+      const StringPiece& line,
       const unsigned separator_id,
-      std::vector<unsigned>* out) {
+      std::vector<unsigned>* out,
+      bool frozen = false) {
     size_t cur = 0;
     size_t last = 0;
     int state = 0;
     out->clear();
-    while(cur < line.size()) {
-      const char cur_char = line[cur++];
+    while(cur < line.size) {
+      const char cur_char = line.data[cur++];
       if (is_ws(cur_char)) {
         if (state == 1) {
-          out->push_back(Convert(line.substr(last, cur - last - 1)));
+          out->push_back(Convert(StringPiece(line.data + last, cur - last - 1),
+                                  frozen));
           state = 0;
         }
         if (cur_char == '\t') out->push_back(separator_id);
@@ -45,30 +90,170 @@ class Dict {
       }
     }
     if (state == 1)
-      out->push_back(Convert(line.substr(last, cur - last)));
+      out->push_back(Convert(StringPiece(line.data + last, cur - last), frozen));
+  }
+
+  inline unsigned Convert(const StringPiece& word, bool frozen = false) {
+    const uint32_t h = Hash(word);
+    size_t b = h & mask_;
+    while (slots_[b].id) {
+      if (slots_[b].hash == h && Equals(slots_[b].id, word))
+        return slots_[b].id;
+      b = (b + 1) & mask_;
+    }
+    if (frozen)
+      return 0;
+    return Add(word, h);
   }
 
   inline unsigned Convert(const std::string& word, bool frozen = false) {
-    MAP_TYPE::iterator i = d_.find(word);
-    if (i == d_.end()) {
-      if (frozen)
-        return 0;
-      words_.push_back(word);
-      d_[word] = words_.size();
-      return words_.size();
-    } else {
-      return i->second;
+    return Convert(StringPiece(word), frozen);
+  }
+
+  // the id of word, or 0 if it isn't in the vocabulary; never adds words,
+  // so any number of threads may look words up at once
+  inline unsigned Lookup(const StringPiece& word) const {
+    const uint32_t h = Hash(word);
+    size_t b = h & mask_;
+    while (slots_[b].id) {
+      if (slots_[b].hash == h && Equals(slots_[b].id, word))
+        return slots_[b].id;
+      b = (b + 1) & mask_;
     }
+    return 0;
+  }
+
+  inline StringPiece Convert(const unsigned id) const {
+    if (id == 0) return StringPiece(b0_);
+    return StringPiece(bytes_ + offs_[id - 1], offs_[id] - offs_[id - 1]);
   }
 
-  inline const std::string& Convert(const unsigned id) const {
-    if (id == 0) return b0_;
-    return words_[id-1];
+  // approximate heap footprint of the vocabulary
+  size_t size_in_bytes() const {
+    return arena_.capacity() + offsets_.capacity() * sizeof(uint64_t) +
+        table_.capacity() * sizeof(Slot);
   }
+
+  // appends the whole vocabulary to *blob as one self-contained block
+  void SerializeToBlob(std::string* blob) const;
+  // makes this a read-only view of a block written by SerializeToBlob;
+  // data must stay valid (and 8-byte aligned) for the lifetime of the view.
+  // Returns the number of bytes used, or 0 if data is not a valid block.
+  size_t InitFromBlob(const char* data, size_t size);
+
  private:
+  struct Slot {
+    uint32_t hash;
+    uint32_t id;  // 0 marks an empty slot
+  };
+  struct BlobHeader {
+    char magic[8];
+    uint64_t num_words;
+    uint64_t num_slots;
+    uint64_t num_bytes;
+  };
+
+  // FNV-1a
+  static inline uint32_t Hash(const StringPiece& word) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < word.size; ++i) {
+      h ^= static_cast<unsigned char>(word.data[i]);
+      h *= 1099511628211ULL;
+    }
+    return static_cast<uint32_t>(h ^ (h >> 32));
+  }
+
+  inline bool Equals(const unsigned id, const StringPiece& word) const {
+    const uint64_t b = offs_[id - 1];
+    return offs_[id] - b == word.size &&
+        memcmp(bytes_ + b, word.data, word.size) == 0;
+  }
+
+  unsigned Add(const StringPiece& word, const uint32_t h) {
+    if (view_) *this = Dict(*this);  // copy on first write
+    if ((size_ + 1) * 10 > table_.size() * 7) {
+      Rehash(table_.size() * 2);
+    }
+    arena_.insert(arena_.end(), word.data, word.data + word.size);
+    offsets_.push_back(arena_.size());
+    const unsigned id = offsets_.size() - 1;
+    size_t b = h & (table_.size() - 1);
+    while (table_[b].id) b = (b + 1) & (table_.size() - 1);
+    table_[b].hash = h;
+    table_[b].id = id;
+    SyncViews();
+    return id;
+  }
+
+  void Rehash(size_t num_slots) {
+    std::vector<Slot> table(num_slots);
+    for (size_t i = 0; i < table_.size(); ++i) {
+      if (!table_[i].id) continue;
+      size_t b = table_[i].hash & (num_slots - 1);
+      while (table[b].id) b = (b + 1) & (num_slots - 1);
+      table[b] = table_[i];
+    }
+    table_.swap(table);
+  }
+
+  void SyncViews() {
+    bytes_ = arena_.data();
+    offs_ = offsets_.data();
+    slots_ = table_.data();
+    size_ = offsets_.size() - 1;
+    mask_ = table_.size() - 1;
+    view_ = false;
+  }
+
   std::string b0_;
-  std::vector<std::string> words_;
-  MAP_TYPE d_;
+  std::vector<char> arena_;
+  std::vector<uint64_t> offsets_;
+  std::vector<Slot> table_;
+  // what lookups read: either the vectors above or an external blob
+  const char* bytes_;
+  const uint64_t* offs_;
+  const Slot* slots_;
+  size_t size_;
+  size_t mask_;
+  bool view_;
 };
 
+// blob layout: header, offsets[num_words + 1], slots[num_slots], bytes,
+// padded to a multiple of 8 bytes
+inline void Dict::SerializeToBlob(std::string* blob) const {
+  BlobHeader h;
+  memcpy(h.magic, "FADICT01", 8);
+  h.num_words = size_;
+  h.num_slots = mask_ + 1;
+  h.num_bytes = offs_[size_];
+  blob->append(reinterpret_cast<const char*>(&h), sizeof(h));
+  blob->append(reinterpret_cast<const char*>(offs_),
+               (size_ + 1) * sizeof(uint64_t));
+  blob->append(reinterpret_cast<const char*>(slots_),
+               (mask_ + 1) * sizeof(Slot));
+  blob->append(bytes_, h.num_bytes);
+  blob->append((8 - h.num_bytes % 8) % 8, '\0');
+}
+
+inline size_t Dict::InitFromBlob(const char* data, size_t size) {
+  BlobHeader h;
+  if (size < sizeof(h)) return 0;
+  memcpy(&h, data, sizeof(h));
+  if (memcmp(h.magic, "FADICT01", 8) != 0) return 0;
+  if (h.num_slots == 0 || (h.num_slots & (h.num_slots - 1))) return 0;
+  const size_t used = sizeof(h) + (h.num_words + 1) * sizeof(uint64_t) +
+      h.num_slots * sizeof(Slot) + h.num_bytes + (8 - h.num_bytes % 8) % 8;
+  if (used > size) return 0;
+  arena_.clear();
+  offsets_.clear();
+  table_.clear();
+  offs_ = reinterpret_cast<const uint64_t*>(data + sizeof(h));
+  slots_ = reinterpret_cast<const Slot*>(offs_ + h.num_words + 1);
+  bytes_ = reinterpret_cast<const char*>(slots_ + h.num_slots);
+  size_ = h.num_words;
+  mask_ = h.num_slots - 1;
+  view_ = true;
+  return used;
+}
+
 #endif
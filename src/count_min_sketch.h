@@ -0,0 +1,101 @@
+#ifndef COUNT_MIN_SKETCH_H_
+#define COUNT_MIN_SKETCH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include <stdint.h>
+
+// Count-min sketch of non-negative weights of (e, f) word pairs in a fixed
+// number of counters: depth rows of width counters, a pair adding to one
+// counter in every row. Estimate() is the smallest of the pair's counters,
+// never below its true total and, with probability 1 - delta, at most
+// epsilon times the sum of all weights above it, for width = e / epsilon
+// and depth = ln(1 / delta). Add() only raises the counters that are below
+// the new estimate (conservative update), which keeps rare pairs much
+// closer to their true totals on skewed data. Integer counters saturate
+// instead of wrapping around. Concurrent adds may lose updates, like the
+// increments of TTable.
+template <class T>
+class CountMinSketch {
+ public:
+  static const unsigned kMaxDepth = 16;
+
+  CountMinSketch() : width_(0), depth_(0) {}
+
+  static size_t WidthFor(double epsilon) {
+    return static_cast<size_t>(std::ceil(M_E / epsilon));
+  }
+  static unsigned DepthFor(double delta) {
+    const double d = std::ceil(std::log(1 / delta));
+    return std::max(1u, std::min(kMaxDepth, static_cast<unsigned>(d)));
+  }
+
+  void Init(size_t width, unsigned depth) {
+    width_ = std::max<size_t>(width, 1);
+    depth_ = std::max(1u, std::min(depth, kMaxDepth));
+    std::vector<T>(width_ * depth_).swap(cells_);
+  }
+
+  bool empty() const { return cells_.empty(); }
+  size_t width() const { return width_; }
+  unsigned depth() const { return depth_; }
+  size_t memory_bytes() const { return cells_.capacity() * sizeof(T); }
+
+  inline void Add(unsigned e, unsigned f, T x) {
+    size_t cell[kMaxDepth];
+    T est = Cells(e, f, cell);
+    est = std::numeric_limits<T>::max() - est < x ?
+        std::numeric_limits<T>::max() : est + x;
+    for (unsigned r = 0; r < depth_; ++r)
+      if (cells_[cell[r]] < est) cells_[cell[r]] = est;
+  }
+
+  inline T Estimate(unsigned e, unsigned f) const {
+    size_t cell[kMaxDepth];
+    return Cells(e, f, cell);
+  }
+
+  void Clear() {
+    const long n = cells_.size();
+    const long kBlock = 1 << 16;
+#pragma omp parallel for schedule(static)
+    for (long b = 0; b < n; b += kBlock)
+      memset(&cells_[b], 0, std::min(kBlock, n - b) * sizeof(T));
+  }
+
+  void swap(CountMinSketch& other) {
+    std::swap(width_, other.width_);
+    std::swap(depth_, other.depth_);
+    cells_.swap(other.cells_);
+  }
+
+ private:
+  // the counters of (e, f), one per row, from two hashes of the pair
+  // (h1 + r * h2), and the smallest of them
+  inline T Cells(unsigned e, unsigned f, size_t* cell) const {
+    uint64_t h = (static_cast<uint64_t>(e) << 32) | f;
+    h += 0x9E3779B97F4A7C15ULL;  // splitmix64
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    const uint32_t h1 = static_cast<uint32_t>(h);
+    const uint32_t h2 = static_cast<uint32_t>(h >> 32) | 1;
+    T est = 0;
+    for (unsigned r = 0; r < depth_; ++r) {
+      const uint32_t g = h1 + r * h2;
+      cell[r] = r * width_ + (static_cast<uint64_t>(g) * width_ >> 32);
+      const T c = cells_[cell[r]];
+      if (r == 0 || c < est) est = c;
+    }
+    return est;
+  }
+
+  size_t width_;
+  unsigned depth_;
+  std::vector<T> cells_;
+};
+
+#endif
@@ -75,6 +75,35 @@ struct DiagonalAlignment {
     return (pct + pcb) / z;
   }
 
+  // Smallest window [*lo, *hi] of source positions around the diagonal
+  // that holds all but a fraction eps of the prior mass of target position
+  // i, whose normalizer ComputeZ(i, m, n, alpha) is z. The prior decays
+  // geometrically (ratio r = exp(-alpha / n)) away from the split point, so
+  // the mass beyond k positions on either side is at most
+  // (p(floor) + p(ceil)) r^k / (1 - r).
+  static void Window(const unsigned i, const unsigned m, const unsigned n, const double alpha, const double z, const double eps, unsigned* lo, unsigned* hi) {
+    *lo = 1;
+    *hi = n;
+    const double ratio = exp(-alpha / n);
+    if (!(ratio < 1.0)) return;
+    const double split = double(i) * n / m;
+    const unsigned floor = static_cast<unsigned>(split);
+    const unsigned ceil = floor + 1;
+    double edge = 0;
+    if (floor) edge += UnnormalizedProb(i, floor, m, n, alpha);
+    if (ceil <= n) edge += UnnormalizedProb(i, ceil, m, n, alpha);
+    const double x = eps * z * (1.0 - ratio) / edge;
+    if (!(x < 1.0)) {
+      // even the nearest positions alone are within the bound
+      *lo = floor ? floor : 1;
+      *hi = ceil <= n ? ceil : n;
+      return;
+    }
+    const double k = std::ceil(log(x) / log(ratio));
+    if (k < floor) *lo = floor + 1 - static_cast<unsigned>(k);
+    if (k < n - floor) *hi = floor + static_cast<unsigned>(k);
+  }
+
   inline static double Feature(const unsigned i, const unsigned j, const unsigned m, const unsigned n) {
     return -fabs(double(j) / n - double(i) / m);
   }
@@ -15,45 +15,24 @@
 
 #include <iostream>
 #include <cstdlib>
-#include <cmath>
-#include <utility>
+#include <algorithm>
 #include <fstream>
 #include <getopt.h>
 #include <sstream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
+#include "src/aligner.h"
+#include "src/alignment_io.h"
 #include "src/corpus.h"
-#include "src/ttables.h"
-#include "src/da.h"
+#include "src/mapped_corpus.h"
+#include "src/numa.h"
+#include "src/run_stats.h"
 
 using namespace std;
 
-struct PairHash {
-  size_t operator()(const pair<short, short>& x) const {
-    return (unsigned short) x.first << 16 | (unsigned) x.second;
-  }
-};
-
-Dict d; // integerization map
-
-void ParseLine(const string& line,
-               vector<unsigned>* src,
-               vector<unsigned>* trg) {
-  static const unsigned kDIV = d.Convert("|||");
-  vector<unsigned> tmp;
-  src->clear();
-  trg->clear();
-  d.ConvertWhitespaceDelimitedLine(line, kDIV, &tmp);
-  unsigned i = 0;
-  while (i < tmp.size() && tmp[i] != kDIV) {
-    src->push_back(tmp[i]);
-    ++i;
-  }
-  if (i < tmp.size() && tmp[i] == kDIV) {
-    ++i;
-    for (; i < tmp.size(); ++i)
-      trg->push_back(tmp[i]);
-  }
-}
+RunStats stats;
 
 string input;
 string conditional_probability_filename = "";
@@ -72,6 +51,21 @@ int no_null_word = 0;
 size_t thread_buffer_size = 10000;
 bool force_align = false;
 int print_scores = 0;
+string stats_filename;
+int num_threads = 0;
+string numa_mode = "off";
+int reorder_corpus = 0;
+double band_epsilon = 0;
+int dedup_corpus = 0;
+int fuse_viterbi = 0;
+double tolerance = 0;
+string dev_filename;
+string binary_output;
+string compact_model_filename;
+int quantize_bits = 8;
+unsigned sketch_min_count = 0;
+double sketch_epsilon = 1e-6;
+double sketch_delta = 0.01;
 struct option options[] = {
     {"input",             required_argument, 0,                  'i'},
     {"reverse",           no_argument,       &is_reverse,        1  },
@@ -88,6 +82,22 @@ struct option options[] = {
     {"no_null_word",      no_argument,       &no_null_word,      1  },
     {"conditional_probabilities", required_argument, 0,          'p'},
     {"thread_buffer_size", required_argument, 0,                 'b'},
+    {"stats_file",        required_argument, 0,                  'S'},
+    {"stats-file",        required_argument, 0,                  'S'},
+    {"threads",           required_argument, 0,                  'j'},
+    {"numa",              required_argument, 0,                  'n'},
+    {"reorder",           no_argument,       &reorder_corpus,    1  },
+    {"band_epsilon",      required_argument, 0,                  'e'},
+    {"dedup",             no_argument,       &dedup_corpus,      1  },
+    {"fuse_viterbi",      no_argument,       &fuse_viterbi,      1  },
+    {"tolerance",         required_argument, 0,                  'X'},
+    {"dev",               required_argument, 0,                  'H'},
+    {"binary_output",     required_argument, 0,                  'B'},
+    {"compact_model",     required_argument, 0,                  'C'},
+    {"quantize_bits",     required_argument, 0,                  'Q'},
+    {"sketch_min_count",  required_argument, 0,                  'K'},
+    {"sketch_epsilon",    required_argument, 0,                  'E'},
+    {"sketch_delta",      required_argument, 0,                  'Y'},
     {0,0,0,0}
 };
 
@@ -96,7 +106,7 @@ bool InitCommandLine(int argc, char** argv) {
     int oi;
     int c = getopt_long(argc,
                         argv,
-                        "i:rI:df:m:t:q:T:ova:Np:b:s",
+                        "i:rI:df:m:t:q:T:ova:Np:b:sS:j:n:Re:DFX:H:B:C:Q:K:E:Y:",
                         options,
                         &oi);
     if (c == -1) break;
@@ -118,6 +128,21 @@ bool InitCommandLine(int argc, char** argv) {
       case 'p': conditional_probability_filename = optarg; break;
       case 'b': thread_buffer_size = atoi(optarg); break;
       case 's': print_scores = 1; break;
+      case 'S': stats_filename = optarg; break;
+      case 'j': num_threads = atoi(optarg); break;
+      case 'n': numa_mode = optarg; break;
+      case 'R': reorder_corpus = 1; break;
+      case 'e': band_epsilon = atof(optarg); break;
+      case 'D': dedup_corpus = 1; break;
+      case 'F': fuse_viterbi = 1; break;
+      case 'X': tolerance = atof(optarg); break;
+      case 'H': dev_filename = optarg; break;
+      case 'B': binary_output = optarg; break;
+      case 'C': compact_model_filename = optarg; break;
+      case 'Q': quantize_bits = atoi(optarg); break;
+      case 'K': sketch_min_count = atoi(optarg); break;
+      case 'E': sketch_epsilon = atof(optarg); break;
+      case 'Y': sketch_delta = atof(optarg); break;
       default: return false;
     }
   }
@@ -125,178 +150,231 @@ bool InitCommandLine(int argc, char** argv) {
   return true;
 }
 
-void UpdateFromPairs(const vector<string>& lines, const int lc, const int iter,
-    const bool final_iteration, const bool use_null, const unsigned kNULL,
-    const double prob_align_not_null, double* c0, double* emp_feat,
-    double* likelihood, TTable* s2t, vector<string>* outputs) {
-  if (final_iteration) {
-    outputs->clear();
-    outputs->resize(lines.size());
+// the library options given on the command line
+AlignerOptions MakeOptions() {
+  AlignerOptions o;
+  o.reverse = is_reverse;
+  o.iterations = ITERATIONS;
+  o.favor_diagonal = favor_diagonal;
+  o.prob_align_null = prob_align_null;
+  o.diagonal_tension = diagonal_tension;
+  o.optimize_tension = optimize_tension;
+  o.variational_bayes = variational_bayes;
+  o.alpha = alpha;
+  o.use_null = !no_null_word;
+  o.mean_srclen_multiplier = mean_srclen_multiplier;
+  o.beam_threshold = beam_threshold;
+  o.thread_buffer_size = thread_buffer_size;
+  o.band_epsilon = band_epsilon;
+  o.dedup = dedup_corpus;
+  o.fuse_viterbi = fuse_viterbi;
+  o.tolerance = tolerance;
+  o.reorder = reorder_corpus;
+  o.sketch_min_count = sketch_min_count;
+  o.sketch_epsilon = sketch_epsilon;
+  o.sketch_delta = sketch_delta;
+  o.numa = numa_mode;
+  return o;
+}
+
+// one line of Pharaoh output: the links in the order of the words the
+// model predicts, then the score with -s
+void FormatAlignment(const AlignmentResult& r, string* out) {
+  ostringstream oss;
+  for (size_t k = 0; k < r.links.size(); ++k) {
+    if (k) oss << ' ';
+    oss << r.links[k].first << '-' << r.links[k].second;
   }
-  double emp_feat_ = 0.0;
-  double c0_ = 0.0;
-  double likelihood_ = 0.0;
-#pragma omp parallel for schedule(dynamic) reduction(+:emp_feat_,c0_,likelihood_)
-  for (int line_idx = 0; line_idx < static_cast<int>(lines.size());
-      ++line_idx) {
-    vector<unsigned> src, trg;
-    ParseLine(lines[line_idx], &src, &trg);
-    if (is_reverse)
-      swap(src, trg);
-    if (src.size() == 0 || trg.size() == 0) {
-      cerr << "Error in line " << lc << "\n" << lines[line_idx] << endl;
-      //return 1;
-    }
-    ostringstream oss; // collect output in last iteration
-    vector<double> probs(src.size() + 1);
-    bool first_al = true;  // used when printing alignments
-    double local_likelihood = 0.0;
-    for (unsigned j = 0; j < trg.size(); ++j) {
-      const unsigned& f_j = trg[j];
-      double sum = 0;
-      double prob_a_i = 1.0 / (src.size() + use_null);  // uniform (model 1)
-      if (use_null) {
-        if (favor_diagonal)
-          prob_a_i = prob_align_null;
-        probs[0] = s2t->prob(kNULL, f_j) * prob_a_i;
-        sum += probs[0];
-      }
-      double az = 0;
-      if (favor_diagonal)
-        az = DiagonalAlignment::ComputeZ(j + 1, trg.size(), src.size(),
-            diagonal_tension) / prob_align_not_null;
-      for (unsigned i = 1; i <= src.size(); ++i) {
-        if (favor_diagonal)
-          prob_a_i = DiagonalAlignment::UnnormalizedProb(j + 1, i, trg.size(),
-              src.size(), diagonal_tension) / az;
-        probs[i] = s2t->prob(src[i - 1], f_j) * prob_a_i;
-        sum += probs[i];
-      }
-      if (final_iteration) {
-        double max_p = -1;
-        int max_index = -1;
-        if (use_null) {
-          max_index = 0;
-          max_p = probs[0];
-        }
-        for (unsigned i = 1; i <= src.size(); ++i) {
-          if (probs[i] > max_p) {
-            max_index = i;
-            max_p = probs[i];
-          }
-        }
-        if (max_index > 0) {
-          if (first_al)
-            first_al = false;
-          else
-            oss << ' ';
-          if (is_reverse)
-            oss << j << '-' << (max_index - 1);
-          else
-            oss << (max_index - 1) << '-' << j;
-        }
-      } else {
-        if (use_null) {
-          double count = probs[0] / sum;
-          c0_ += count;
-          s2t->Increment(kNULL, f_j, count);
-        }
-        for (unsigned i = 1; i <= src.size(); ++i) {
-          const double p = probs[i] / sum;
-          s2t->Increment(src[i - 1], f_j, p);
-          emp_feat_ += DiagonalAlignment::Feature(j, i, trg.size(), src.size()) * p;
-        }
-      }
-      local_likelihood += log(sum);
-    }
-    likelihood_ += local_likelihood;
-    if (final_iteration) {
-      if (print_scores) {
-        double log_prob = Md::log_poisson(trg.size(), 0.05 + src.size() * mean_srclen_multiplier);
-        log_prob += local_likelihood;
-        oss << " ||| " << log_prob;
-      }
-      oss << endl;
-      (*outputs)[line_idx] = oss.str();
-    }
+  if (print_scores)
+    oss << " ||| " << r.log_prob;
+  oss << endl;
+  *out = oss.str();
+}
+
+// one record of --binary_output
+void EncodeAlignment(const AlignmentResult& r, string* out) {
+  Alignment a;
+  a.width = r.src_size;
+  a.height = r.trg_size;
+  a.links = r.links;
+  sort(a.links.begin(), a.links.end());
+  BinaryAlignmentFormat::Encode(a, print_scores, r.log_prob, out);
+}
+
+// fills in what is known at the end of the run: the hyperparameters
+// (including the learned ones, from opts) and the size of the model
+void CollectFinalStats(const AlignerOptions& opts, const Aligner& model) {
+  StatsRecord& p = stats.params;
+  NumaTopology topology;
+  p.Set("numa_nodes", topology.num_nodes());
+  p.Set("input", input);
+  p.Set("reverse", opts.reverse);
+  p.Set("iterations", opts.iterations);
+  p.Set("favor_diagonal", opts.favor_diagonal);
+  p.Set("diagonal_tension", opts.diagonal_tension);
+  p.Set("optimize_tension", opts.optimize_tension);
+  p.Set("mean_srclen_multiplier", opts.mean_srclen_multiplier);
+  p.Set("p0", opts.prob_align_null);
+  p.Set("use_null", opts.use_null);
+  p.Set("variational_bayes", opts.variational_bayes);
+  p.Set("alpha", opts.alpha);
+  p.Set("beam_threshold", opts.beam_threshold);
+  p.Set("thread_buffer_size", opts.thread_buffer_size);
+  p.Set("force_align", force_align);
+  int threads = 1;
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#endif
+  p.Set("threads", threads);
+  p.Set("numa", opts.numa);
+  p.Set("reorder", opts.reorder);
+  p.Set("band_epsilon", opts.band_epsilon);
+  p.Set("dedup", opts.dedup);
+  p.Set("fuse_viterbi", opts.fuse_viterbi);
+  p.Set("tolerance", opts.tolerance);
+  p.Set("dev", dev_filename);
+  p.Set("binary_output", binary_output);
+  p.Set("compact_model", compact_model_filename);
+  p.Set("sketch_min_count", opts.sketch_min_count);
+  if (opts.sketch_min_count) {
+    p.Set("sketch_epsilon", opts.sketch_epsilon);
+    p.Set("sketch_delta", opts.sketch_delta);
   }
-  *emp_feat += emp_feat_;
-  *c0 += c0_;
-  *likelihood += likelihood_;
+  model.CollectModelStats(&stats.model);
 }
 
-inline void AddTranslationOptions(vector<vector<unsigned> >& insert_buffer,
-    TTable* s2t) {
-  s2t->SetMaxE(insert_buffer.size()-1);
-#pragma omp parallel for schedule(dynamic)
-  for (unsigned e = 0; e < insert_buffer.size(); ++e) {
-    for (unsigned f : insert_buffer[e]) {
-      s2t->Insert(e, f);
-    }
-    insert_buffer[e].clear();
+// writes model to -C, if given
+bool SaveCompactModel(const Aligner& model) {
+  if (compact_model_filename.empty()) return true;
+  Timer timer;
+  cerr << "compact model: " << compact_model_filename << endl;
+  if (!model.SaveCompactModel(compact_model_filename, quantize_bits)) {
+    cerr << "Can't write " << compact_model_filename << endl;
+    return false;
   }
+  stats.phases.Add("export_compact", timer.Lap());
+  return true;
 }
 
-void InitialPass(const unsigned kNULL, const bool use_null, TTable* s2t,
-    double* n_target_tokens, double* tot_len_ratio,
-    vector<pair<pair<short, short>, unsigned>>* size_counts) {
-  ifstream in(input.c_str());
-  if (!in) {
-    cerr << "Can't read " << input << endl;
+// aligns the lines of the input ("-" or none for stdin) with the model of
+// -f, one at a time, echoing each line before its alignment
+int ForceAlign(const AlignerOptions& opts) {
+  Timer timer;
+  Aligner aligner(opts);
+  if (!aligner.LoadModel(conditional_probability_filename)) {
+    cerr << "Can't read " << conditional_probability_filename << endl;
+    return 1;
   }
-  unordered_map<pair<short, short>, unsigned, PairHash> size_counts_;
-  vector<vector<unsigned>> insert_buffer;
-  size_t insert_buffer_items = 0;
-  vector<unsigned> src, trg;
+  stats.phases.Add("load_model", timer.Lap());
+  if (aligner.compact() && !compact_model_filename.empty()) {
+    cerr << "-C needs a model in the text format" << endl;
+    return 1;
+  }
+  if (!SaveCompactModel(aligner)) return 1;
+  timer.Lap();
+  istream* pin = &cin;
+  if (input != "-" && !input.empty())
+    pin = new ifstream(input.c_str());
+  istream& in = *pin;
   string line;
-  bool flag = false;
+  vector<unsigned> src, trg;
+  vector<StringPiece> src_words, trg_words;
+  vector<SentencePair> pairs(1);
+  vector<AlignmentResult> results;
   int lc = 0;
-  cerr << "INITIAL PASS " << endl;
-  while (true) {
-    getline(in, line);
-    if (!in)
-      break;
-    lc++;
-    if (lc % 1000 == 0) { cerr << '.'; flag = true; }
-    if (lc %50000 == 0) { cerr << " [" << lc << "]\n" << flush; flag = false; }
-    ParseLine(line, &src, &trg);
-    if (is_reverse)
-      swap(src, trg);
+  double tlp = 0;
+  size_t unknown = 0;
+  while(getline(in, line)) {
+    ++lc;
+    aligner.LookUpLine(line, &src, &trg, &src_words, &trg_words);
+    for (const StringPiece& s : src_words) cout << s << ' ';
+    cout << "|||";
+    for (const StringPiece& t : trg_words) cout << ' ' << t;
+    cout << " |||";
     if (src.size() == 0 || trg.size() == 0) {
-      cerr << "Error in line " << lc << "\n" << line << endl;
+      cerr << "Error in line " << lc << endl;
+      return 1;
     }
-    *tot_len_ratio += static_cast<double>(trg.size()) / static_cast<double>(src.size());
-    *n_target_tokens += trg.size();
-    if (use_null) {
-      for (const unsigned f : trg) {
-        s2t->Insert(kNULL, f);
-      }
+    pairs[0] = SentencePair(WordSpan(src), WordSpan(trg));
+    aligner.AlignBatch(pairs, &results);
+    const AlignmentResult& r = results[0];
+    for (const Alignment::Link& l : r.links)
+      cout << ' ' << l.first << '-' << l.second;
+    tlp += r.log_prob;
+    cout << " ||| " << r.log_prob << endl << flush;
+    unknown += count(src.begin(), src.end(), Aligner::kUnknownWord) +
+               count(trg.begin(), trg.end(), Aligner::kUnknownWord);
+  } // loop over test set sentences
+  cerr << "TOTAL LOG PROB " << tlp << endl;
+  stats.phases.Add("force_align", timer.Lap());
+  stats.corpus.Set("lines", lc);
+  stats.corpus.Set("unknown_words", unknown);
+  CollectFinalStats(aligner.options(), aligner);
+  return 0;
+}
+
+// trains on the input, writing the final alignments to stdout (or
+// --binary_output) and the model to -p
+int Train(const AlignerOptions& opts) {
+  MappedCorpus corpus;
+  if (!corpus.Open(input)) {
+    cerr << "Can't read " << input << endl;
+    return 1;
+  }
+  MappedCorpus dev;
+  if (!dev_filename.empty() && !dev.Open(dev_filename)) {
+    cerr << "Can't read " << dev_filename << endl;
+    return 1;
+  }
+  ofstream binary_file, binary_index;
+  unique_ptr<BinaryAlignmentWriter> binary_writer;
+  if (!binary_output.empty()) {
+    binary_file.open(binary_output.c_str(), ios::binary);
+    binary_index.open((binary_output + ".idx").c_str(), ios::binary);
+    if (!binary_file || !binary_index) {
+      cerr << "Can't write " << binary_output << endl;
+      return 1;
     }
-    for (const unsigned e : src) {
-      if (e >= insert_buffer.size()) {
-        insert_buffer.resize(e+1);
-      }
-      for (const unsigned f : trg) {
-        insert_buffer[e].push_back(f);
-      }
-      insert_buffer_items += trg.size();
+    binary_writer.reset(
+        new BinaryAlignmentWriter(&binary_file, &binary_index, print_scores));
+  }
+  vector<string> outputs;
+  const AlignmentSink sink = [&](const vector<AlignmentResult>& results) {
+    outputs.resize(results.size());
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int k = 0; k < static_cast<int>(results.size()); ++k) {
+      if (binary_writer)
+        EncodeAlignment(results[k], &outputs[k]);
+      else
+        FormatAlignment(results[k], &outputs[k]);
     }
-    if (insert_buffer_items > thread_buffer_size * 100) {
-      insert_buffer_items = 0;
-      AddTranslationOptions(insert_buffer, s2t);
+    for (const string& output : outputs) {
+      if (binary_writer)
+        binary_writer->WriteEncoded(output);
+      else
+        cout << output;
     }
-    ++size_counts_[make_pair<short, short>(trg.size(), src.size())];
-  }
-  for (const auto& p : size_counts_) {
-    size_counts->push_back(p);
+  };
+  Trainer trainer(opts, &stats);
+  string error;
+  if (!trainer.Train(corpus.lines(), dev.lines(), sink, &error)) {
+    cerr << error << endl;
+    return 1;
   }
-  AddTranslationOptions(insert_buffer, s2t);
-
-  mean_srclen_multiplier = (*tot_len_ratio) / lc;
-  if (flag) {
-    cerr << endl;
+  stats.corpus.Set("bytes", corpus.size());
+  if (binary_writer) binary_writer->Close();
+  if (!conditional_probability_filename.empty()) {
+    Timer timer;
+    cerr << "conditional probabilities: " << conditional_probability_filename << endl;
+    if (!trainer.aligner().SaveModel(conditional_probability_filename)) {
+      cerr << "Can't write " << conditional_probability_filename << endl;
+      return 1;
+    }
+    stats.phases.Add("export", timer.Lap());
   }
-  cerr << "expected target length = source length * " << mean_srclen_multiplier << endl;
+  if (!SaveCompactModel(trainer.aligner())) return 1;
+  CollectFinalStats(trainer.aligner().options(), trainer.aligner());
+  return 0;
 }
 
 int main(int argc, char** argv) {
@@ -315,181 +393,74 @@ int main(int argc, char** argv) {
          << "  -N: No null word\n"
          << "  -a: alpha parameter for optional Dirichlet prior (default = 0.01)\n"
          << "  -T: starting lambda for diagonal distance parameter (default = 4)\n"
-         << "  -s: print alignment scores (alignment ||| score, disabled by default)\n";
+         << "  -s: print alignment scores (alignment ||| score, disabled by default)\n"
+         << "  --stats_file FILE: write timings, throughput, model size and\n"
+         << "      hyperparameters of the run to FILE as JSON\n"
+         << "  -j, --threads N: number of worker threads (default: OpenMP's)\n"
+         << "  -n, --numa MODE: pin the worker threads round-robin over the NUMA\n"
+         << "      nodes and place the translation table pages with MODE, either\n"
+         << "      interleave (spread over all nodes) or firsttouch (on the node\n"
+         << "      of the thread that copies the row); off by default\n"
+         << "  -R, --reorder: number words by frequency and train on the sentences\n"
+         << "      grouped by their rarest word, for better cache reuse on large\n"
+         << "      vocabularies (alignments are still written in input order)\n"
+         << "  -e, --band_epsilon EPS: with -d, only evaluate the source positions\n"
+         << "      holding all but EPS of each target word's diagonal prior mass\n"
+         << "      (default 0: all of them)\n"
+         << "  -D, --dedup: train on each distinct sentence pair once, weighted by\n"
+         << "      its number of copies (every input line is still aligned)\n"
+         << "  -F, --fuse_viterbi: also train in the final iteration and decode the\n"
+         << "      alignments from its posteriors, so -I N trains N times in N passes\n"
+         << "      instead of N - 1 times\n"
+         << "  -X, --tolerance X: stop training (and run the final pass) once the\n"
+         << "      cross entropy improves by less than X (relative) in an iteration;\n"
+         << "      -I is then the maximum number of iterations\n"
+         << "  -H, --dev FILE: report the cross entropy of the held-out sentence pairs\n"
+         << "      in FILE after every iteration, and use it for --tolerance\n"
+         << "  -B, --binary_output FILE: write the alignments to FILE in the binary\n"
+         << "      format read by atools (with an index in FILE.idx) instead of\n"
+         << "      to stdout; not with -f\n"
+         << "  -C, --compact_model FILE: also write the model (as pruned for -p)\n"
+         << "      to FILE in a compact, quantized form that -f loads by mapping\n"
+         << "      it; with -f, converts the text model given to -f\n"
+         << "  -Q, --quantize_bits N: bits per log probability in -C, 8 or 16\n"
+         << "      (default 8)\n"
+         << "  -K, --sketch_min_count N: give exact parameters only to the word\n"
+         << "      pairs that co-occur at least N times, and estimate the others\n"
+         << "      with a count-min sketch (default 0: all exact); -p and -C\n"
+         << "      only write the exact ones\n"
+         << "  -E, --sketch_epsilon X: with -K, relative error bound of the\n"
+         << "      sketch, which has e / X counters per row (default 1e-6)\n"
+         << "  -Y, --sketch_delta X: with -K, probability of exceeding the bound,\n"
+         << "      the sketch having ln(1 / X) rows (default 0.01)\n";
     return 1;
   }
-  const bool use_null = !no_null_word;
-  if (variational_bayes && alpha <= 0.0) {
-    cerr << "--alpha must be > 0\n";
+  if (quantize_bits != 8 && quantize_bits != 16) {
+    cerr << "--quantize_bits must be 8 or 16" << endl;
     return 1;
   }
-  const double prob_align_not_null = 1.0 - prob_align_null;
-  const unsigned kNULL = d.Convert("<eps>");
-  TTable s2t, t2s;
-  vector<pair<pair<short, short>, unsigned>> size_counts;
-  double tot_len_ratio = 0;
-  double n_target_tokens = 0;
-
-  if (force_align) {
-    ifstream in(conditional_probability_filename.c_str());
-    s2t.DeserializeLogProbsFromText(&in, d);
-    ITERATIONS = 0; // don't do any learning
-  } else {
-    InitialPass(kNULL, use_null, &s2t, &n_target_tokens, &tot_len_ratio, &size_counts);
-    s2t.Freeze();
+  if (force_align && !binary_output.empty()) {
+    // forced alignment echoes the sentences, which the format can't hold
+    cerr << "-B can't be used with -f" << endl;
+    return 1;
   }
-
-  for (int iter = 0; iter < ITERATIONS; ++iter) {
-    const bool final_iteration = (iter == (ITERATIONS - 1));
-    cerr << "ITERATION " << (iter + 1) << (final_iteration ? " (FINAL)" : "") << endl;
-    ifstream in(input.c_str());
-    if (!in) {
-      cerr << "Can't read " << input << endl;
+  AlignerOptions opts = MakeOptions();
+  if (force_align) opts.iterations = 0;  // no learning
+  const string error = opts.Check();
+  if (!error.empty()) {
+    cerr << error << endl;
+    return 1;
+  }
+#ifdef _OPENMP
+  if (num_threads > 0) omp_set_num_threads(num_threads);
+#endif
+  const int status = force_align ? ForceAlign(opts) : Train(opts);
+  if (status != 0) return status;
+  if (!stats_filename.empty()) {
+    if (!stats.WriteJsonFile(stats_filename)) {
+      cerr << "Can't write " << stats_filename << endl;
       return 1;
     }
-    double likelihood = 0;
-    const double denom = n_target_tokens;
-    int lc = 0;
-    bool flag = false;
-    string line;
-    double c0 = 0;
-    double emp_feat = 0;
-    vector<string> buffer;
-    vector<string> outputs;
-    while(true) {
-      getline(in, line);
-      if (!in) break;
-      ++lc;
-      if (lc % 1000 == 0) { cerr << '.'; flag = true; }
-      if (lc %50000 == 0) { cerr << " [" << lc << "]\n" << flush; flag = false; }
-      buffer.push_back(line);
-
-      if (buffer.size() >= thread_buffer_size) {
-        UpdateFromPairs(buffer, lc, iter, final_iteration, use_null, kNULL,
-            prob_align_not_null, &c0, &emp_feat, &likelihood, &s2t, &outputs);
-        if (final_iteration) {
-          for (const string& output : outputs) {
-            cout << output;
-          }
-        }
-        buffer.clear();
-      }
-    } // end data loop
-    if (buffer.size() > 0) {
-      UpdateFromPairs(buffer, lc, iter, final_iteration, use_null, kNULL,
-          prob_align_not_null, &c0, &emp_feat, &likelihood, &s2t, &outputs);
-      if (final_iteration) {
-        for (const string& output : outputs) {
-          cout << output;
-        }
-      }
-      buffer.clear();
-    }
-
-    // log(e) = 1.0
-    double base2_likelihood = likelihood / log(2);
-
-    if (flag) {
-      cerr << endl;
-    }
-    emp_feat /= n_target_tokens;
-    cerr << "  log_e likelihood: " << likelihood << endl;
-    cerr << "  log_2 likelihood: " << base2_likelihood << endl;
-    cerr << "     cross entropy: " << (-base2_likelihood / denom) << endl;
-    cerr << "        perplexity: " << pow(2.0, -base2_likelihood / denom) << endl;
-    cerr << "      posterior p0: " << c0 / n_target_tokens << endl;
-    cerr << " posterior al-feat: " << emp_feat << endl;
-    //cerr << "     model tension: " << mod_feat / toks << endl;
-    cerr << "       size counts: " << size_counts.size() << endl;
-    if (!final_iteration) {
-      if (favor_diagonal && optimize_tension && iter > 0) {
-        for (int ii = 0; ii < 8; ++ii) {
-          double mod_feat = 0;
-#pragma omp parallel for reduction(+:mod_feat)
-          for(size_t i = 0; i < size_counts.size(); ++i) {
-            const pair<short,short>& p = size_counts[i].first;
-            for (short j = 1; j <= p.first; ++j)
-              mod_feat += size_counts[i].second * DiagonalAlignment::ComputeDLogZ(j, p.first, p.second, diagonal_tension);
-          }
-          mod_feat /= n_target_tokens;
-          cerr << "  " << ii + 1 << "  model al-feat: " << mod_feat << " (tension=" << diagonal_tension << ")\n";
-          diagonal_tension += (emp_feat - mod_feat) * 20.0;
-          if (diagonal_tension <= 0.1) diagonal_tension = 0.1;
-          if (diagonal_tension > 14) diagonal_tension = 14;
-        }
-        cerr << "     final tension: " << diagonal_tension << endl;
-      }
-      if (variational_bayes)
-        s2t.NormalizeVB(alpha);
-      else
-        s2t.Normalize();
-    }
-  }
-  if (!force_align && !conditional_probability_filename.empty()) {
-    cerr << "conditional probabilities: " << conditional_probability_filename << endl;
-    s2t.ExportToFile(conditional_probability_filename.c_str(), d, beam_threshold);
-  }
-  if (force_align) {
-    istream* pin = &cin;
-    if (input != "-" && !input.empty())
-      pin = new ifstream(input.c_str());
-    istream& in = *pin;
-    string line;
-    vector<unsigned> src, trg;
-    int lc = 0;
-    double tlp = 0;
-    while(getline(in, line)) {
-      ++lc;
-      ParseLine(line, &src, &trg);
-      for (auto s : src) cout << d.Convert(s) << ' ';
-      cout << "|||";
-      for (auto t : trg) cout << ' ' << d.Convert(t);
-      cout << " |||";
-      if (is_reverse)
-        swap(src, trg);
-      if (src.size() == 0 || trg.size() == 0) {
-        cerr << "Error in line " << lc << endl;
-        return 1;
-      }
-      double log_prob = Md::log_poisson(trg.size(), 0.05 + src.size() * mean_srclen_multiplier);
-
-      // compute likelihood
-      for (unsigned j = 0; j < trg.size(); ++j) {
-        unsigned f_j = trg[j];
-        double sum = 0;
-        int a_j = 0;
-        double max_pat = 0;
-        double prob_a_i = 1.0 / (src.size() + use_null);  // uniform (model 1)
-        if (use_null) {
-          if (favor_diagonal) prob_a_i = prob_align_null;
-          max_pat = s2t.safe_prob(kNULL, f_j) * prob_a_i;
-          sum += max_pat;
-        }
-        double az = 0;
-        if (favor_diagonal)
-          az = DiagonalAlignment::ComputeZ(j+1, trg.size(), src.size(), diagonal_tension) / prob_align_not_null;
-        for (unsigned i = 1; i <= src.size(); ++i) {
-          if (favor_diagonal)
-            prob_a_i = DiagonalAlignment::UnnormalizedProb(j + 1, i, trg.size(), src.size(), diagonal_tension) / az;
-          double pat = s2t.safe_prob(src[i-1], f_j) * prob_a_i;
-          if (pat > max_pat) { max_pat = pat; a_j = i; }
-          sum += pat;
-        }
-        log_prob += log(sum);
-        if (true) {
-          if (a_j > 0) {
-            cout << ' ';
-            if (is_reverse)
-              cout << j << '-' << (a_j - 1);
-            else
-              cout << (a_j - 1) << '-' << j;
-          }
-        }
-      }
-      tlp += log_prob;
-      cout << " ||| " << log_prob << endl << flush;
-    } // loop over test set sentences
-    cerr << "TOTAL LOG PROB " << tlp << endl;
   }
   return 0;
 }
@@ -0,0 +1,152 @@
+#include "src/fast_align_c.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/aligner.h"
+#include "src/atools_commands.h"
+
+using namespace std;
+
+struct fa_aligner {
+  explicit fa_aligner(const AlignerOptions& opts) : aligner(opts) {}
+  Aligner aligner;
+};
+
+namespace {
+
+// pair k of a link buffer, with the grid size atools would read from text;
+// false if a position is negative (it would wrap around to a grid of
+// width or height 0)
+bool ReadLinks(const int32_t* links, size_t count, Alignment* a) {
+  unsigned max_x = 0;
+  unsigned max_y = 0;
+  a->links.resize(count);
+  for (size_t k = 0; k < count; ++k) {
+    if (links[2 * k] < 0 || links[2 * k + 1] < 0) return false;
+    const unsigned x = links[2 * k];
+    const unsigned y = links[2 * k + 1];
+    max_x = max(max_x, x);
+    max_y = max(max_y, y);
+    a->links[k] = Alignment::Link(x, y);
+  }
+  sort(a->links.begin(), a->links.end());
+  a->links.erase(unique(a->links.begin(), a->links.end()), a->links.end());
+  a->width = max_x + 1;
+  a->height = max_y + 1;
+  return true;
+}
+
+Command* MakeSymmetrizer(const string& heuristic) {
+  if (heuristic == "intersect") return new IntersectCommand;
+  if (heuristic == "union") return new UnionCommand;
+  if (heuristic == "grow-diag") return new GDCommand;
+  if (heuristic == "grow-diag-final") return new GDFCommand;
+  if (heuristic == "grow-diag-final-and") return new GDFACommand;
+  return NULL;
+}
+
+}  // namespace
+
+int fa_api_version(void) { return FA_API_VERSION; }
+
+fa_aligner* fa_aligner_load(const char* params_file, int flags,
+                            double diagonal_tension,
+                            double mean_srclen_multiplier,
+                            double prob_align_null) {
+  AlignerOptions opts;
+  opts.reverse = flags & FA_REVERSE;
+  opts.favor_diagonal = flags & FA_FAVOR_DIAGONAL;
+  opts.use_null = !(flags & FA_NO_NULL_WORD);
+  opts.diagonal_tension = diagonal_tension;
+  opts.mean_srclen_multiplier = mean_srclen_multiplier;
+  opts.prob_align_null = prob_align_null;
+  opts.log = NULL;
+  unique_ptr<fa_aligner> a(new fa_aligner(opts));
+  if (!a->aligner.LoadModel(params_file)) return NULL;
+  return a.release();
+}
+
+void fa_aligner_free(fa_aligner* aligner) { delete aligner; }
+
+long fa_align_batch(const fa_aligner* aligner, size_t n,
+                    const char* const* src, const char* const* trg,
+                    int32_t* links, size_t max_links, size_t* link_counts,
+                    double* scores) {
+  const Aligner& a = aligner->aligner;
+  vector<vector<unsigned> > ids(2 * n);
+  vector<SentencePair> pairs(n);
+#pragma omp parallel for schedule(dynamic, 64) if(n > 1)
+  for (long k = 0; k < static_cast<long>(n); ++k) {
+    // unknown words get Aligner::kUnknownWord
+    a.LookUpWords(StringPiece(src[k], strlen(src[k])), &ids[2 * k]);
+    a.LookUpWords(StringPiece(trg[k], strlen(trg[k])), &ids[2 * k + 1]);
+    pairs[k] = SentencePair(WordSpan(ids[2 * k]), WordSpan(ids[2 * k + 1]));
+  }
+  // the positions have to fit in the int32_t of the links
+  for (size_t k = 0; k < 2 * n; ++k)
+    if (ids[k].size() > static_cast<size_t>(INT32_MAX)) return -3;
+  vector<AlignmentResult> results;
+  a.AlignBatch(pairs, &results);
+  size_t total = 0;
+  for (size_t k = 0; k < n; ++k)
+    total += results[k].links.size();
+  if (total > max_links) return -1;
+  int32_t* out = links;
+  for (size_t k = 0; k < n; ++k) {
+    const AlignmentResult& r = results[k];
+    for (const Alignment::Link& l : r.links) {
+      *out++ = l.first;
+      *out++ = l.second;
+    }
+    link_counts[k] = r.links.size();
+    scores[k] = r.log_prob;
+  }
+  return total;
+}
+
+long fa_symmetrize(const char* heuristic, size_t n,
+                   const int32_t* fwd_links, const size_t* fwd_counts,
+                   const int32_t* rev_links, const size_t* rev_counts,
+                   int32_t* links, size_t max_links, size_t* link_counts) {
+  unique_ptr<Command> check(MakeSymmetrizer(heuristic));
+  if (!check) return -2;
+  vector<size_t> fwd_start(n + 1), rev_start(n + 1);
+  for (size_t k = 0; k < n; ++k) {
+    fwd_start[k + 1] = fwd_start[k] + fwd_counts[k];
+    rev_start[k + 1] = rev_start[k] + rev_counts[k];
+  }
+  vector<Alignment> out(n);
+  vector<char> bad(n, 0);
+#pragma omp parallel if(n > 1)
+  {
+    unique_ptr<Command> cmd(MakeSymmetrizer(heuristic));
+    Alignment fwd, rev;
+#pragma omp for schedule(dynamic, 64)
+    for (long k = 0; k < static_cast<long>(n); ++k) {
+      if (!ReadLinks(fwd_links + 2 * fwd_start[k], fwd_counts[k], &fwd) ||
+          !ReadLinks(rev_links + 2 * rev_start[k], rev_counts[k], &rev)) {
+        bad[k] = 1;
+        continue;
+      }
+      cmd->Apply(fwd, rev, &out[k]);
+    }
+  }
+  if (find(bad.begin(), bad.end(), 1) != bad.end()) return -3;
+  size_t total = 0;
+  for (size_t k = 0; k < n; ++k)
+    total += out[k].links.size();
+  if (total > max_links) return -1;
+  int32_t* p = links;
+  for (size_t k = 0; k < n; ++k) {
+    for (const Alignment::Link& l : out[k].links) {
+      *p++ = l.first;
+      *p++ = l.second;
+    }
+    link_counts[k] = out[k].links.size();
+  }
+  return total;
+}
@@ -0,0 +1,72 @@
+#ifndef FAST_ALIGN_C_H_
+#define FAST_ALIGN_C_H_
+
+/* C interface of the fast_align shared library (libfast_align_c), for
+ * bindings such as force_align.py. Only opaque handles, plain integers and
+ * caller-provided buffers cross it, so it stays binary compatible as the
+ * C++ code changes; fa_api_version() is bumped on incompatible changes.
+ *
+ * Sentences are pre-tokenized: words separated by spaces or tabs. Links
+ * are written as (source, target) pairs of 0-based word positions, two
+ * int32_t each, the links of pair k following those of pair k - 1. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FA_API_VERSION 1
+
+/* flags of fa_aligner_load, as the fast_align options -r, -d and -N */
+#define FA_REVERSE 1
+#define FA_FAVOR_DIAGONAL 2
+#define FA_NO_NULL_WORD 4
+
+typedef struct fa_aligner fa_aligner;
+
+int fa_api_version(void);
+
+/* Loads a model written by fast_align -p, or by -C (mapped instead of
+ * read, so aligners using the same file share its memory).
+ * diagonal_tension and mean_srclen_multiplier are the values learned in
+ * training (-T and -m of forced alignment), prob_align_null is -q (0.08 by
+ * default). Returns NULL if the file can't be read. */
+fa_aligner* fa_aligner_load(const char* params_file, int flags,
+                            double diagonal_tension,
+                            double mean_srclen_multiplier,
+                            double prob_align_null);
+void fa_aligner_free(fa_aligner* aligner);
+
+/* Aligns n sentence pairs (src[k], trg[k]) in parallel. Words the model
+ * hasn't seen get the floor probability. Pair k gets link_counts[k] links
+ * and the score scores[k] (log p(target | source), as printed by forced
+ * alignment). There is at most one link per target word (per source word
+ * with FA_REVERSE), so max_links = the total number of words always
+ * suffices. Returns the number of links written, or -1 if more than
+ * max_links are needed (nothing is written then), or -3 if a sentence has
+ * more words than an int32_t position can number. Safe to call from
+ * several threads at once. */
+long fa_align_batch(const fa_aligner* aligner, size_t n,
+                    const char* const* src, const char* const* trg,
+                    int32_t* links, size_t max_links, size_t* link_counts,
+                    double* scores);
+
+/* Symmetrizes n pairs of forward and reverse alignments (in the layout
+ * above, both as (source, target) pairs) with an atools heuristic:
+ * intersect, union, grow-diag, grow-diag-final or grow-diag-final-and.
+ * The links of each pair come out sorted; at most fwd + rev links per pair.
+ * Returns the number of links written, -1 if max_links is too small, -2
+ * if the heuristic is unknown or -3 if a link has a negative position
+ * (nothing is written then). */
+long fa_symmetrize(const char* heuristic, size_t n,
+                   const int32_t* fwd_links, const size_t* fwd_counts,
+                   const int32_t* rev_links, const size_t* rev_counts,
+                   int32_t* links, size_t max_links, size_t* link_counts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
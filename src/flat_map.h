@@ -0,0 +1,371 @@
+#ifndef FLAT_MAP_H_
+#define FLAT_MAP_H_
+
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <stdint.h>
+
+#include "src/row_arena.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Open-addressing map from 32-bit word ids to doubles, tuned for the rows of
+// a TTable: lots of tiny maps, a few huge ones, no erase, and read-mostly
+// once training starts.
+//
+// Storage is one block: a control array (one byte per slot) followed by the
+// (key, value) slots. Slots are probed in aligned groups of 16; a control
+// byte holds 7 bits of the key's hash, kEmpty, or kSentinel (padding for
+// tables with fewer than 16 slots). A probe compares the hash byte against
+// all 16 control bytes at once (SSE2 if available) and only looks at the
+// keys that agree.
+//
+// Blocks come from the global allocator, or from a RowArena if one is
+// given; copies share the source's arena.
+class FlatWord2Double {
+ public:
+  struct value_type {
+    unsigned first;
+    double second;
+  };
+
+  template <class V>
+  class Iterator {
+   public:
+    Iterator() : ctrl_(NULL), slots_(NULL), i_(0), n_(0) {}
+    Iterator(const uint8_t* ctrl, V* slots, uint32_t i, uint32_t n) :
+        ctrl_(ctrl), slots_(slots), i_(i), n_(n) {}
+    // allow iterator -> const_iterator
+    template <class V2>
+    Iterator(const Iterator<V2>& o) :
+        ctrl_(o.ctrl_), slots_(o.slots_), i_(o.i_), n_(o.n_) {}
+    V& operator*() const { return slots_[i_]; }
+    V* operator->() const { return &slots_[i_]; }
+    Iterator& operator++() { ++i_; SkipEmpty(); return *this; }
+    bool operator==(const Iterator& o) const { return i_ == o.i_; }
+    bool operator!=(const Iterator& o) const { return i_ != o.i_; }
+    void SkipEmpty() { while (i_ < n_ && (ctrl_[i_] & 0x80)) ++i_; }
+   private:
+    template <class V2> friend class Iterator;
+    const uint8_t* ctrl_;
+    V* slots_;
+    uint32_t i_;
+    uint32_t n_;
+  };
+  typedef Iterator<value_type> iterator;
+  typedef Iterator<const value_type> const_iterator;
+
+  explicit FlatWord2Double(RowArena* arena = NULL) :
+      ctrl_(EmptyGroup()), arena_(arena), capacity_(0), size_(0) {}
+  FlatWord2Double(const FlatWord2Double& rhs) :
+      ctrl_(EmptyGroup()), arena_(rhs.arena_), capacity_(0), size_(0) {
+    CopyFrom(rhs);
+  }
+  const FlatWord2Double& operator=(const FlatWord2Double& rhs) {
+    if (this != &rhs) {
+      Deallocate();
+      arena_ = rhs.arena_;
+      CopyFrom(rhs);
+    }
+    return *this;
+  }
+  FlatWord2Double(FlatWord2Double&& rhs) noexcept :
+      ctrl_(rhs.ctrl_), arena_(rhs.arena_), capacity_(rhs.capacity_),
+      size_(rhs.size_) {
+    rhs.ctrl_ = EmptyGroup();
+    rhs.capacity_ = 0;
+    rhs.size_ = 0;
+  }
+  FlatWord2Double& operator=(FlatWord2Double&& rhs) noexcept {
+    swap(rhs);
+    return *this;
+  }
+  ~FlatWord2Double() { Deallocate(); }
+
+  void swap(FlatWord2Double& rhs) {
+    std::swap(ctrl_, rhs.ctrl_);
+    std::swap(arena_, rhs.arena_);
+    std::swap(capacity_, rhs.capacity_);
+    std::swap(size_, rhs.size_);
+  }
+
+  // replaces the contents with a copy of rhs at the smallest capacity that
+  // holds it, allocated from arena, or placed in block (compact_bytes() of
+  // arena's memory) if it isn't NULL
+  void AssignCompact(const FlatWord2Double& rhs, RowArena* arena,
+                     void* block = NULL) {
+    if (this == &rhs) return;
+    Deallocate();
+    arena_ = arena;
+    const uint32_t cap = CapacityFor(rhs.size_);
+    if (cap == rhs.capacity_) {
+      CopyFrom(rhs, block);
+      return;
+    }
+    Allocate(cap, block);
+    for (const_iterator it = rhs.begin(); it != rhs.end(); ++it)
+      slots()[InsertNew(it->first)].second = it->second;
+  }
+  // bytes AssignCompact() would allocate for a copy of this map
+  size_t compact_bytes() const {
+    const uint32_t cap = CapacityFor(size_);
+    return cap ? BlockBytes(cap) : 0;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t bucket_count() const { return capacity_; }
+  // bytes of the slot block (not counting the map object itself)
+  size_t memory_bytes() const {
+    return capacity_ ? BlockBytes(capacity_) : 0;
+  }
+
+  // fraction of slots that may be filled before a table with 16 or more
+  // slots grows; shared by all maps
+  static float max_load_factor() { return MaxLoad(); }
+  static void max_load_factor(float f) {
+    assert(f > 0.0f && f < 1.0f);
+    MaxLoad() = f;
+  }
+
+  iterator begin() {
+    iterator it(ctrl_, slots(), 0, capacity_);
+    it.SkipEmpty();
+    return it;
+  }
+  iterator end() { return iterator(ctrl_, slots(), capacity_, capacity_); }
+  const_iterator begin() const {
+    const_iterator it(ctrl_, slots(), 0, capacity_);
+    it.SkipEmpty();
+    return it;
+  }
+  const_iterator end() const {
+    return const_iterator(ctrl_, slots(), capacity_, capacity_);
+  }
+
+  // the entries in slots [first, last), so that a big map can be processed
+  // in independent pieces; slot_count() is the number of slots
+  size_t slot_count() const { return capacity_; }
+  iterator slot_begin(const size_t first, const size_t last) {
+    iterator it(ctrl_, slots(), first, last);
+    it.SkipEmpty();
+    return it;
+  }
+  iterator slot_end(const size_t last) {
+    return iterator(ctrl_, slots(), last, last);
+  }
+
+  iterator find(const unsigned key) {
+    const uint32_t i = FindIndex(key);
+    return iterator(ctrl_, slots(), i, capacity_);
+  }
+  const_iterator find(const unsigned key) const {
+    const uint32_t i = FindIndex(key);
+    return const_iterator(ctrl_, slots(), i, capacity_);
+  }
+  size_t count(const unsigned key) const {
+    return FindIndex(key) != capacity_;
+  }
+
+  double& operator[](const unsigned key) {
+    uint32_t i = FindIndex(key);
+    if (i == capacity_) {
+      if (NeedsGrowth()) Rehash(GrownCapacity());
+      i = InsertNew(key);
+    }
+    return slots()[i].second;
+  }
+
+  void clear() {
+    Deallocate();
+    ctrl_ = EmptyGroup();
+    capacity_ = 0;
+    size_ = 0;
+  }
+
+  // makes room for n entries without further growth
+  void reserve(size_t n) {
+    const uint32_t c = CapacityFor(n);
+    if (c > capacity_) Rehash(c);
+  }
+
+  // shrinks the table to the smallest capacity that holds the current size
+  void shrink_to_fit() {
+    const uint32_t c = CapacityFor(size_);
+    if (c < capacity_) Rehash(c);
+  }
+
+ private:
+  enum { kGroupWidth = 16 };
+  static const uint8_t kEmpty = 0x80;
+  static const uint8_t kSentinel = 0xFF;
+
+  static float& MaxLoad() {
+    static float max_load = 0.875f;
+    return max_load;
+  }
+
+  static uint8_t* EmptyGroup() {
+    alignas(16) static uint8_t group[kGroupWidth] = {
+      kSentinel, kSentinel, kSentinel, kSentinel,
+      kSentinel, kSentinel, kSentinel, kSentinel,
+      kSentinel, kSentinel, kSentinel, kSentinel,
+      kSentinel, kSentinel, kSentinel, kSentinel };
+    return group;
+  }
+
+  static uint64_t Hash(const unsigned key) {
+    return static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL;
+  }
+  static uint8_t H2(const uint64_t h) { return h >> 57; }
+
+  static uint32_t CtrlBytes(const uint32_t cap) {
+    return cap < kGroupWidth ? kGroupWidth : cap;
+  }
+  static size_t BlockBytes(const uint32_t cap) {
+    return CtrlBytes(cap) + static_cast<size_t>(cap) * sizeof(value_type);
+  }
+
+  // bit k of the result is set if control byte k of the group matches
+  static inline uint32_t Match(const uint8_t* g, const uint8_t h2) {
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2)));
+#else
+    uint32_t m = 0;
+    for (int k = 0; k < kGroupWidth; ++k)
+      m |= static_cast<uint32_t>(g[k] == h2) << k;
+    return m;
+#endif
+  }
+  // empty or sentinel: the probe sequence of a missing key ends here
+  static inline uint32_t MatchEmptyOrSentinel(const uint8_t* g) {
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(g)));
+#else
+    uint32_t m = 0;
+    for (int k = 0; k < kGroupWidth; ++k)
+      m |= static_cast<uint32_t>(g[k] >> 7) << k;
+    return m;
+#endif
+  }
+  static inline int LowestBit(const uint32_t m) { return __builtin_ctz(m); }
+
+  value_type* slots() const {
+    return reinterpret_cast<value_type*>(ctrl_ + CtrlBytes(capacity_));
+  }
+
+  uint32_t GroupMask() const {
+    return capacity_ < kGroupWidth ? 0 : capacity_ / kGroupWidth - 1;
+  }
+
+  // index of key, or capacity_ if absent
+  inline uint32_t FindIndex(const unsigned key) const {
+    const uint64_t h = Hash(key);
+    const uint8_t h2 = H2(h);
+    const uint32_t gmask = GroupMask();
+    const value_type* s = slots();
+    uint32_t g = (h >> 16) & gmask;
+    while (true) {
+      const uint8_t* group = ctrl_ + g * kGroupWidth;
+      for (uint32_t m = Match(group, h2); m; m &= m - 1) {
+        const uint32_t i = g * kGroupWidth + LowestBit(m);
+        if (s[i].first == key) return i;
+      }
+      if (MatchEmptyOrSentinel(group)) return capacity_;
+      g = (g + 1) & gmask;
+    }
+  }
+
+  // key must be absent and the table must have room
+  uint32_t InsertNew(const unsigned key) {
+    const uint64_t h = Hash(key);
+    const uint32_t gmask = GroupMask();
+    uint32_t g = (h >> 16) & gmask;
+    while (true) {
+      const uint8_t* group = ctrl_ + g * kGroupWidth;
+      const uint32_t m = Match(group, kEmpty);
+      if (m) {
+        const uint32_t i = g * kGroupWidth + LowestBit(m);
+        ctrl_[i] = H2(h);
+        value_type& v = slots()[i];
+        v.first = key;
+        v.second = 0.0;
+        ++size_;
+        return i;
+      }
+      g = (g + 1) & gmask;
+    }
+  }
+
+  // tables smaller than one group may fill up completely, since the
+  // sentinel bytes still terminate probes; larger ones keep an empty slot
+  static uint32_t CapacityFor(const size_t n) {
+    if (n == 0) return 0;
+    uint32_t c = 1;
+    while (c < n) c <<= 1;
+    if (c < kGroupWidth) return c;
+    while (n > c * MaxLoad() || n >= c) c <<= 1;
+    return c;
+  }
+  bool NeedsGrowth() const {
+    if (capacity_ < kGroupWidth) return size_ == capacity_;
+    return size_ + 1 > capacity_ * MaxLoad() || size_ + 1 >= capacity_;
+  }
+  uint32_t GrownCapacity() const { return CapacityFor(size_ + 1); }
+
+  void Allocate(const uint32_t cap, void* block = NULL) {
+    capacity_ = cap;
+    size_ = 0;
+    if (cap == 0) {
+      ctrl_ = EmptyGroup();
+      return;
+    }
+    if (!block)
+      block = arena_ ? arena_->Allocate(BlockBytes(cap))
+                     : ::operator new(BlockBytes(cap));
+    ctrl_ = static_cast<uint8_t*>(block);
+    memset(ctrl_, kEmpty, cap);
+    if (cap < kGroupWidth)
+      memset(ctrl_ + cap, kSentinel, kGroupWidth - cap);
+  }
+
+  void Deallocate() {
+    if (ctrl_ != EmptyGroup()) Free(ctrl_, capacity_);
+  }
+  void Free(uint8_t* ctrl, const uint32_t cap) {
+    if (arena_)
+      arena_->Free(ctrl, BlockBytes(cap));
+    else
+      ::operator delete(ctrl);
+  }
+
+  void Rehash(const uint32_t cap) {
+    uint8_t* old_ctrl = ctrl_;
+    const uint32_t old_cap = capacity_;
+    const value_type* old_slots = slots();
+    Allocate(cap);
+    for (uint32_t i = 0; i < old_cap; ++i) {
+      if (old_ctrl[i] & 0x80) continue;
+      slots()[InsertNew(old_slots[i].first)].second = old_slots[i].second;
+    }
+    if (old_cap) Free(old_ctrl, old_cap);
+  }
+
+  void CopyFrom(const FlatWord2Double& rhs, void* block = NULL) {
+    Allocate(rhs.capacity_, block);
+    if (capacity_) memcpy(ctrl_, rhs.ctrl_, BlockBytes(capacity_));
+    size_ = rhs.size_;
+  }
+
+  uint8_t* ctrl_;
+  RowArena* arena_;
+  uint32_t capacity_;
+  uint32_t size_;
+};
+
+#endif
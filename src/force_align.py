@@ -1,68 +1,135 @@
 #!/usr/bin/env python
 
+import ctypes
+import json
 import os
-import subprocess
 import sys
-import threading
 
-# Simplified, non-threadsafe version for force_align.py
-# Use the version in realtime for development
+# must match src/fast_align_c.h
+FA_API_VERSION = 1
+FA_REVERSE = 1
+FA_FAVOR_DIAGONAL = 2
+
+def load_library(path=None):
+    # libfast_align_c.so is built next to this script; ctypes.CDLL releases
+    # the GIL while the library aligns
+    if path is None:
+        path = os.environ.get('FAST_ALIGN_LIB') or os.path.join(
+            os.path.dirname(os.path.abspath(__file__)), 'libfast_align_c.so')
+    lib = ctypes.CDLL(path)
+    lib.fa_api_version.restype = ctypes.c_int
+    if lib.fa_api_version() != FA_API_VERSION:
+        raise RuntimeError('{} has API version {}, expected {}'.format(
+            path, lib.fa_api_version(), FA_API_VERSION))
+    links = ctypes.POINTER(ctypes.c_int32)
+    counts = ctypes.POINTER(ctypes.c_size_t)
+    words = ctypes.POINTER(ctypes.c_char_p)
+    lib.fa_aligner_load.argtypes = [ctypes.c_char_p, ctypes.c_int,
+        ctypes.c_double, ctypes.c_double, ctypes.c_double]
+    lib.fa_aligner_load.restype = ctypes.c_void_p
+    lib.fa_aligner_free.argtypes = [ctypes.c_void_p]
+    lib.fa_aligner_free.restype = None
+    lib.fa_align_batch.argtypes = [ctypes.c_void_p, ctypes.c_size_t, words,
+        words, links, ctypes.c_size_t, counts, ctypes.POINTER(ctypes.c_double)]
+    lib.fa_align_batch.restype = ctypes.c_long
+    lib.fa_symmetrize.argtypes = [ctypes.c_char_p, ctypes.c_size_t, links,
+        counts, links, counts, links, ctypes.c_size_t, counts]
+    lib.fa_symmetrize.restype = ctypes.c_long
+    return lib
+
+# Forward and reverse models, symmetrized, aligning in-process through the
+# C interface of the fast_align library
 class Aligner:
 
-    def __init__(self, fwd_params, fwd_err, rev_params, rev_err, heuristic='grow-diag-final-and'):
+    def __init__(self, fwd_params, fwd_err, rev_params, rev_err, heuristic='grow-diag-final-and', lib=None):
 
-        build_root = os.path.dirname(os.path.abspath(__file__))
-        fast_align = os.path.join(build_root, 'fast_align')
-        atools = os.path.join(build_root, 'atools')
+        self.lib = lib or load_library()
 
         (fwd_T, fwd_m) = self.read_err(fwd_err)
         (rev_T, rev_m) = self.read_err(rev_err)
 
-        fwd_cmd = [fast_align, '-i', '-', '-d', '-T', fwd_T, '-m', fwd_m, '-f', fwd_params]
-        rev_cmd = [fast_align, '-i', '-', '-d', '-T', rev_T, '-m', rev_m, '-f', rev_params, '-r']
-        tools_cmd = [atools, '-i', '-', '-j', '-', '-c', heuristic]
+        self.fwd = self.load(fwd_params, FA_FAVOR_DIAGONAL, fwd_T, fwd_m)
+        self.rev = self.load(rev_params, FA_FAVOR_DIAGONAL | FA_REVERSE, rev_T, rev_m)
+        self.heuristic = heuristic.encode('utf-8')
 
-        self.fwd_align = popen_io(fwd_cmd)
-        self.rev_align = popen_io(rev_cmd)
-        self.tools = popen_io(tools_cmd)
+    def load(self, params, flags, T, m):
+        aligner = self.lib.fa_aligner_load(params.encode('utf-8'), flags, float(T), float(m), 0.08)
+        if not aligner:
+            raise IOError('cannot read {}'.format(params))
+        return aligner
 
     def align(self, line):
-        self.fwd_align.stdin.write('{}\n'.format(line))
-        self.rev_align.stdin.write('{}\n'.format(line))
-        # f words ||| e words ||| links ||| score
-        fwd_line = self.fwd_align.stdout.readline().split('|||')[2].strip()
-        rev_line = self.rev_align.stdout.readline().split('|||')[2].strip()
-        self.tools.stdin.write('{}\n'.format(fwd_line))
-        self.tools.stdin.write('{}\n'.format(rev_line))
-        al_line = self.tools.stdout.readline().strip()
-        return al_line
- 
+        return self.align_batch([line])[0]
+
+    def align_batch(self, lines):
+        # "f words ||| e words" lines (str or bytes) -> symmetrized links
+        n = len(lines)
+        src = (ctypes.c_char_p * n)()
+        trg = (ctypes.c_char_p * n)()
+        max_links = 0
+        for (k, line) in enumerate(lines):
+            if not isinstance(line, bytes):
+                line = line.encode('utf-8')
+            (f, _, e) = line.partition(b'|||')
+            # the arrays point into (and keep) the bytes objects
+            src[k] = f
+            trg[k] = e
+            # at most one link per word
+            max_links += (len(f) + len(e)) // 2 + 2
+        (fwd, fwd_counts) = self.run(self.fwd, n, src, trg, max_links)
+        (rev, rev_counts) = self.run(self.rev, n, src, trg, max_links)
+        links = (ctypes.c_int32 * (4 * max_links))()
+        counts = (ctypes.c_size_t * n)()
+        r = self.lib.fa_symmetrize(self.heuristic, n, fwd, fwd_counts, rev, rev_counts, links, 2 * max_links, counts)
+        if r == -2:
+            raise ValueError('unknown heuristic {}'.format(self.heuristic))
+        if r < 0:
+            raise RuntimeError('fa_symmetrize failed ({})'.format(r))
+        out = []
+        pos = 0
+        for k in range(n):
+            end = pos + 2 * counts[k]
+            pairs = links[pos:end]
+            out.append(' '.join('{}-{}'.format(pairs[i], pairs[i + 1]) for i in range(0, len(pairs), 2)))
+            pos = end
+        return out
+
+    def run(self, aligner, n, src, trg, max_links):
+        links = (ctypes.c_int32 * (2 * max_links))()
+        counts = (ctypes.c_size_t * n)()
+        scores = (ctypes.c_double * n)()
+        r = self.lib.fa_align_batch(aligner, n, src, trg, links, max_links, counts, scores)
+        if r == -1:
+            raise RuntimeError('link buffer too small')
+        if r < 0:
+            raise RuntimeError('fa_align_batch failed ({})'.format(r))
+        return (links, counts)
+
     def close(self):
-        self.fwd_align.stdin.close()
-        self.fwd_align.wait()
-        self.rev_align.stdin.close()
-        self.rev_align.wait()
-        self.tools.stdin.close()
-        self.tools.wait()
+        self.lib.fa_aligner_free(self.fwd)
+        self.lib.fa_aligner_free(self.rev)
+        self.fwd = self.rev = None
 
     def read_err(self, err):
-        (T, m) = ('', '')
-        for line in open(err):
-            # expected target length = source length * N
-            if 'expected target length' in line:
-                m = line.split()[-1]
-            # final tension: N
-            elif 'final tension' in line:
-                T = line.split()[-1]
-        return (T, m)
-
-def popen_io(cmd):
-    p = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
-    def consume(s):
-        for _ in s:
+        # the defaults of fast_align -T and -m, for logs that don't have them
+        # (e.g. trained without -o, so the tension was never optimized)
+        (T, m) = ('4.0', '1.0')
+        # JSON file written by fast_align --stats_file
+        try:
+            with open(err) as f:
+                params = json.load(f)['params']
+            return (repr(params['diagonal_tension']), repr(params['mean_srclen_multiplier']))
+        except (ValueError, KeyError):
             pass
-    threading.Thread(target=consume, args=(p.stderr,)).start()
-    return p
+        with open(err) as f:
+            for line in f:
+                # expected target length = source length * N
+                if 'expected target length' in line:
+                    m = line.split()[-1]
+                # final tension: N
+                elif 'final tension' in line:
+                    T = line.split()[-1]
+        return (T, m)
 
 def main():
 
@@ -74,6 +141,8 @@ def main():
         sys.stderr.write('then run:\n')
         sys.stderr.write('  {} fwd_params fwd_err rev_params rev_err [heuristic] <in.f-e >out.f-e.gdfa\n'.format(sys.argv[0]))
         sys.stderr.write('\n')
+        sys.stderr.write('fwd_err and rev_err may also be the JSON files written with --stats_file\n')
+        sys.stderr.write('\n')
         sys.stderr.write('where heuristic is one of: (intersect union grow-diag grow-diag-final grow-diag-final-and) default=grow-diag-final-and\n')
         sys.exit(2)
 
@@ -90,5 +159,3 @@ def main():
     
 if __name__ == '__main__':
     main()
-
-
@@ -1,14 +1,72 @@
 #ifndef SRC_HASHTABLES_H
 #define SRC_HASHTABLES_H
 
-#ifdef HAVE_SPARSEHASH
+#include "src/row_arena.h"
+
+#if defined(USE_FLAT_HASH)
+#include "src/flat_map.h"
+typedef FlatWord2Double Word2Double;
+
+// rows of the flat map take their storage from a RowArena; the other
+// backends ignore the arena
+inline Word2Double NewWord2Double(RowArena* arena) {
+  return Word2Double(arena);
+}
+// block: CompactWord2DoubleBytes(from) bytes of arena's memory for the copy
+inline void CompactWord2Double(const Word2Double& from, RowArena* arena,
+                               void* block, Word2Double* to) {
+  to->AssignCompact(from, arena, block);
+}
+inline size_t CompactWord2DoubleBytes(const Word2Double& m) {
+  return m.compact_bytes();
+}
+inline size_t Word2DoubleBytes(const Word2Double& m) {
+  return m.memory_bytes();
+}
+// a row can be visited in pieces by ranges of its slots
+inline size_t Word2DoubleSlots(const Word2Double& m) {
+  return m.slot_count();
+}
+template <class F>
+inline void ForEachInSlots(Word2Double& m, size_t first, size_t last, F f) {
+  for (Word2Double::iterator it = m.slot_begin(first, last);
+       it != m.slot_end(last); ++it)
+    f(it->second);
+}
+#elif defined(HAVE_SPARSEHASH)
 #include <google/sparse_hash_map>
-typedef google::sparse_hash_map<std::string, unsigned, std::hash<std::string> > MAP_TYPE;
 typedef google::sparse_hash_map<unsigned, double> Word2Double;
+
+// estimate: packed values plus the occupancy bitmaps
+inline size_t Word2DoubleBytes(const Word2Double& m) {
+  return m.size() * sizeof(Word2Double::value_type) + m.bucket_count() / 4;
+}
 #else
 #include <unordered_map>
-typedef std::unordered_map<std::string, unsigned, std::hash<std::string> > MAP_TYPE;
 typedef std::unordered_map<unsigned, double> Word2Double;
+
+// estimate: one node (next pointer + value) per entry plus the buckets
+inline size_t Word2DoubleBytes(const Word2Double& m) {
+  return m.size() * (sizeof(void*) + sizeof(Word2Double::value_type)) +
+      m.bucket_count() * sizeof(void*);
+}
+#endif
+
+#if !defined(USE_FLAT_HASH)
+inline Word2Double NewWord2Double(RowArena*) { return Word2Double(); }
+inline void CompactWord2Double(const Word2Double& from, RowArena*, void*,
+                               Word2Double* to) {
+  *to = from;
+}
+inline size_t CompactWord2DoubleBytes(const Word2Double&) { return 0; }
+// the other backends can't be split: a row is the single slot [0, 1)
+inline size_t Word2DoubleSlots(const Word2Double&) { return 1; }
+template <class F>
+inline void ForEachInSlots(Word2Double& m, size_t first, size_t, F f) {
+  if (first == 0)
+    for (Word2Double::iterator it = m.begin(); it != m.end(); ++it)
+      f(it->second);
+}
 #endif
 
 #endif
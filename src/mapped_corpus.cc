@@ -0,0 +1,99 @@
+#include "src/mapped_corpus.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+bool MappedCorpus::Open(const string& filename) {
+  Close();
+  if (filename == "-")
+    return ReadStream(&cin);
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      madvise(p, st.st_size, MADV_WILLNEED);
+      close(fd);
+      data_ = static_cast<const char*>(p);
+      size_ = st.st_size;
+      mapped_ = true;
+      IndexLines();
+      return true;
+    }
+  }
+  close(fd);
+  ifstream in(filename.c_str());
+  if (!in) return false;
+  return ReadStream(&in);
+}
+
+void MappedCorpus::Close() {
+  if (mapped_)
+    munmap(const_cast<char*>(data_), size_);
+  data_ = NULL;
+  size_ = 0;
+  mapped_ = false;
+  buffer_.clear();
+  lines_.clear();
+}
+
+bool MappedCorpus::ReadStream(istream* in) {
+  buffer_.assign(istreambuf_iterator<char>(*in), istreambuf_iterator<char>());
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+  IndexLines();
+  return true;
+}
+
+// Each thread owns the lines that start inside its byte range [b, e), where
+// a line starts at offset 0 or right after a '\n'. Ranges are found
+// independently per thread and the per-thread results concatenated in order.
+void MappedCorpus::IndexLines() {
+  lines_.clear();
+  if (size_ == 0) return;
+  int num_chunks = 1;
+#ifdef _OPENMP
+  num_chunks = omp_get_max_threads();
+#endif
+  if (size_ < static_cast<size_t>(num_chunks) * 4096) num_chunks = 1;
+  const char* const data = data_;
+  const size_t size = size_;
+  vector<vector<StringPiece> > chunks(num_chunks);
+#pragma omp parallel for schedule(static)
+  for (int c = 0; c < num_chunks; ++c) {
+    // first line start at or after a raw byte offset
+    auto line_start = [data, size](size_t raw) -> size_t {
+      if (raw == 0) return 0;
+      const void* nl = memchr(data + raw - 1, '\n', size - raw + 1);
+      return nl ? static_cast<const char*>(nl) - data + 1 : size;
+    };
+    size_t cur = line_start(size * c / num_chunks);
+    const size_t end = line_start(size * (c + 1) / num_chunks);
+    vector<StringPiece>& out = chunks[c];
+    while (cur < end) {
+      const void* nl = memchr(data + cur, '\n', size - cur);
+      const size_t eol = nl ? static_cast<const char*>(nl) - data : size;
+      out.push_back(StringPiece(data + cur, eol - cur));
+      cur = eol + 1;
+    }
+  }
+  size_t n = 0;
+  for (int c = 0; c < num_chunks; ++c) n += chunks[c].size();
+  lines_.reserve(n);
+  for (int c = 0; c < num_chunks; ++c) {
+    lines_.insert(lines_.end(), chunks[c].begin(), chunks[c].end());
+    vector<StringPiece>().swap(chunks[c]);
+  }
+}
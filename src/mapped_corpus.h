@@ -0,0 +1,38 @@
+#ifndef MAPPED_CORPUS_H_
+#define MAPPED_CORPUS_H_
+
+#include <string>
+#include <vector>
+
+#include "src/corpus.h"
+
+// Read-only view of a whole corpus file. Regular files are mmap'd so lines
+// and tokens can refer directly to the mapped pages; anything else (e.g.
+// stdin given as "-") is read into a private buffer. The line index is built
+// in parallel over newline-aligned chunks of the file.
+class MappedCorpus {
+ public:
+  MappedCorpus() : data_(NULL), size_(0), mapped_(false) {}
+  ~MappedCorpus() { Close(); }
+
+  // returns false if the file can't be read
+  bool Open(const std::string& filename);
+  void Close();
+
+  const std::vector<StringPiece>& lines() const { return lines_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedCorpus(const MappedCorpus&);
+  void operator=(const MappedCorpus&);
+  bool ReadStream(std::istream* in);
+  void IndexLines();
+
+  const char* data_;
+  size_t size_;
+  bool mapped_;
+  std::string buffer_;  // used when the input can't be mapped
+  std::vector<StringPiece> lines_;
+};
+
+#endif
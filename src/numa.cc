@@ -0,0 +1,151 @@
+#include "src/numa.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+vector<int> ParseCpuList(const string& list) {
+  vector<int> cpus;
+  istringstream in(list);
+  string range;
+  while (getline(in, range, ',')) {
+    if (range.empty() || range[0] < '0' || range[0] > '9') continue;
+    const size_t dash = range.find('-');
+    const int first = atoi(range.c_str());
+    const int last = dash == string::npos ? first : atoi(range.c_str() + dash + 1);
+    for (int c = first; c <= last; ++c) cpus.push_back(c);
+  }
+  return cpus;
+}
+
+NumaTopology::NumaTopology() {
+#ifdef __linux__
+  // only CPUs this process may run on (taskset, cgroups) are used
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  const bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+  DIR* dir = opendir("/sys/devices/system/node");
+  if (dir) {
+    vector<int> ids;
+    while (struct dirent* e = readdir(dir)) {
+      const string name = e->d_name;
+      if (name.compare(0, 4, "node") == 0 && name.size() > 4 &&
+          name[4] >= '0' && name[4] <= '9')
+        ids.push_back(atoi(name.c_str() + 4));
+    }
+    closedir(dir);
+    sort(ids.begin(), ids.end());
+    for (unsigned i = 0; i < ids.size(); ++i) {
+      ostringstream path;
+      path << "/sys/devices/system/node/node" << ids[i] << "/cpulist";
+      ifstream in(path.str().c_str());
+      string list;
+      getline(in, list);
+      vector<int> cpus;
+      const vector<int> all = ParseCpuList(list);
+      for (unsigned j = 0; j < all.size(); ++j)
+        if (!have_mask || (all[j] < CPU_SETSIZE && CPU_ISSET(all[j], &allowed)))
+          cpus.push_back(all[j]);
+      if (cpus.empty()) continue;
+      ids_.push_back(ids[i]);
+      nodes_.push_back(cpus);
+    }
+  }
+#endif
+  if (nodes_.empty()) {
+    // no NUMA information: one node with every CPU
+    vector<int> cpus;
+#ifdef __linux__
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+      if (have_mask && CPU_ISSET(c, &allowed)) cpus.push_back(c);
+#endif
+    if (cpus.empty()) cpus.push_back(0);
+    ids_.push_back(0);
+    nodes_.push_back(cpus);
+  }
+}
+
+unsigned NumaTopology::num_cpus() const {
+  unsigned n = 0;
+  for (unsigned i = 0; i < nodes_.size(); ++i) n += nodes_[i].size();
+  return n;
+}
+
+bool NumaTopology::PinThreads() const {
+#if defined(__linux__) && defined(_OPENMP)
+  bool ok = true;
+#pragma omp parallel reduction(&&:ok)
+  {
+    // thread t goes to node t % nodes, filling each node's CPUs in order
+    const unsigned t = omp_get_thread_num();
+    const vector<int>& cpus = nodes_[t % nodes_.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[(t / nodes_.size()) % cpus.size()], &set);
+    ok = sched_setaffinity(0, sizeof(set), &set) == 0;
+  }
+  return ok;
+#else
+  return false;
+#endif
+}
+
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+namespace {
+// constants from <linux/mempolicy.h>
+const int kMpolDefault = 0;
+const int kMpolInterleave = 3;
+
+// set_mempolicy in every thread of the OpenMP team, the calling thread
+// (its master) included
+bool SetTeamPolicy(int mode, const unsigned long* mask, unsigned long maxnode) {
+  bool ok = true;
+#pragma omp parallel reduction(&&:ok)
+  ok = syscall(SYS_set_mempolicy, mode, mask, maxnode) == 0;
+  return ok;
+}
+}
+#endif
+
+bool NumaTopology::InterleaveAllocations() const {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+  if (nodes_.size() < 2) return true;
+  const unsigned bits = 8 * sizeof(unsigned long);
+  vector<unsigned long> mask(ids_.back() / bits + 1);
+  for (unsigned i = 0; i < ids_.size(); ++i)
+    mask[ids_[i] / bits] |= 1UL << (ids_[i] % bits);
+  return SetTeamPolicy(kMpolInterleave, &mask[0], mask.size() * bits + 1);
+#else
+  return false;
+#endif
+}
+
+bool NumaTopology::LocalAllocations() const {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+  if (nodes_.size() < 2) return true;
+  return SetTeamPolicy(kMpolDefault, NULL, 0);
+#else
+  return false;
+#endif
+}
+
+string NumaTopology::Describe() const {
+  ostringstream os;
+  os << nodes_.size() << " NUMA node" << (nodes_.size() == 1 ? "" : "s") << " (";
+  for (unsigned i = 0; i < nodes_.size(); ++i)
+    os << (i ? "+" : "") << nodes_[i].size();
+  os << " CPUs)";
+  return os.str();
+}
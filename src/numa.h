@@ -0,0 +1,45 @@
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <string>
+#include <vector>
+
+// Minimal NUMA support without libnuma: the node layout is read from
+// /sys/devices/system/node, threads are pinned with sched_setaffinity and
+// page placement is steered with the set_mempolicy system call. On systems
+// without NUMA information (or not Linux) there is a single node holding
+// every CPU and the placement calls do nothing.
+class NumaTopology {
+ public:
+  NumaTopology();
+
+  unsigned num_nodes() const { return nodes_.size(); }
+  const std::vector<int>& cpus(unsigned node) const { return nodes_[node]; }
+  unsigned num_cpus() const;
+
+  // pins the threads of the next OpenMP parallel regions (which must use
+  // the same team size) round-robin over the nodes, one CPU per thread, so
+  // every node gets its share of the threads; returns false if the
+  // affinity can't be set
+  bool PinThreads() const;
+  // pages first touched from now on by the calling thread or the threads
+  // of the next OpenMP parallel regions (which must use the same team size,
+  // as for PinThreads) are spread round-robin over all nodes; the policy
+  // belongs to each thread, so it is set in every thread of the team
+  bool InterleaveAllocations() const;
+  // back to the default policy for the same threads (pages land on the
+  // node of the thread touching them first)
+  bool LocalAllocations() const;
+
+  // e.g. "2 NUMA nodes (16+16 CPUs)"
+  std::string Describe() const;
+
+ private:
+  std::vector<int> ids_;  // kernel node numbers, which may have gaps
+  std::vector<std::vector<int> > nodes_;
+};
+
+// parses a kernel CPU list such as "0-3,8,10-11"
+std::vector<int> ParseCpuList(const std::string& list);
+
+#endif
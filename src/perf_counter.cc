@@ -0,0 +1,65 @@
+#include "src/perf_counter.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+CacheMissCounter::CacheMissCounter() {
+#if defined(__linux__) && defined(SYS_perf_event_open)
+  int threads = 1;
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#endif
+  vector<pid_t> tids(threads);
+#pragma omp parallel num_threads(threads)
+  {
+    int t = 0;
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+#endif
+    tids[t] = syscall(SYS_gettid);
+  }
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  for (int t = 0; t < threads; ++t) {
+    const int fd = syscall(SYS_perf_event_open, &attr, tids[t], -1, -1, 0);
+    if (fd < 0) {
+      for (unsigned i = 0; i < fds_.size(); ++i) close(fds_[i]);
+      fds_.clear();
+      return;
+    }
+    fds_.push_back(fd);
+  }
+#endif
+}
+
+CacheMissCounter::~CacheMissCounter() {
+#ifdef __linux__
+  for (unsigned i = 0; i < fds_.size(); ++i) close(fds_[i]);
+#endif
+}
+
+uint64_t CacheMissCounter::Read() const {
+  uint64_t total = 0;
+#ifdef __linux__
+  for (unsigned i = 0; i < fds_.size(); ++i) {
+    uint64_t count = 0;
+    if (read(fds_[i], &count, sizeof(count)) == sizeof(count))
+      total += count;
+  }
+#endif
+  return total;
+}
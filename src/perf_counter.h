@@ -0,0 +1,29 @@
+#ifndef PERF_COUNTER_H_
+#define PERF_COUNTER_H_
+
+#include <stdint.h>
+#include <vector>
+
+// Hardware cache misses of the OpenMP worker threads, counted with
+// perf_event_open (Linux only). One counter is attached to every thread of
+// the current team, so the count is only complete while later parallel
+// regions use the same team size. Where the kernel doesn't allow counting
+// (containers, virtual machines without a PMU, a high
+// perf_event_paranoid) available() is false and Read() returns 0.
+class CacheMissCounter {
+ public:
+  CacheMissCounter();
+  ~CacheMissCounter();
+
+  bool available() const { return !fds_.empty(); }
+  // misses counted in user space since construction, over all threads
+  uint64_t Read() const;
+
+ private:
+  CacheMissCounter(const CacheMissCounter&);
+  void operator=(const CacheMissCounter&);
+
+  std::vector<int> fds_;
+};
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef POSTERIOR_H_
+#define POSTERIOR_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "src/compact_ttable.h"
+#include "src/da.h"
+#include "src/ttables.h"
+
+// Alignment posteriors of one sentence pair under the fast_align model,
+// shared by training (counting), the final Viterbi pass and forced
+// alignment. The mode flags are template parameters, so each combination
+// is compiled without the tests in the per-cell loop:
+//   kUseNull      target words may align to the NULL source word
+//   kDiagonal     the diagonal prior (otherwise uniform, i.e. model 1)
+//   kViterbi      decode the best link of every target word instead of
+//                 adding expected counts to the table (when counting, the
+//                 links can still be decoded on the side, see Run)
+//   kSafeProbs    look parameters up with safe_prob (forced alignment with
+//                 a model that may lack the pair) instead of prob
+// The variational Bayes option only changes the M-step, so it is not a
+// parameter here. The table is TTable, or the read-only CompactTTable when
+// decoding with a compact model.
+//
+// With the diagonal prior and band_epsilon > 0, only the band of source
+// positions around the diagonal that holds all but band_epsilon of the
+// prior mass of a target word (DiagonalAlignment::Window) is evaluated,
+// plus NULL. The band covers about 2 ln(1 / band_epsilon) / tension of the
+// source sentence, so the saving depends on the tension, not the length.
+struct PosteriorOptions {
+  PosteriorOptions()
+      : kNULL(), prob_align_null(), diagonal_tension(), band_epsilon() {}
+  unsigned kNULL;
+  double prob_align_null;
+  double diagonal_tension;
+  double band_epsilon;
+};
+
+// expected counts gathered while counting
+struct PosteriorTotals {
+  PosteriorTotals() : c0(), emp_feat(), cells(), dropped_prior() {}
+  double c0;        // expected number of links to NULL
+  double emp_feat;  // expected diagonal feature
+  double cells;     // alignment cells evaluated, including NULL
+  // largest prior mass left out of the band for a target word (at most
+  // band_epsilon of the non-NULL mass)
+  double dropped_prior;
+};
+
+// adds expected counts to the table; decoding doesn't, so read-only tables
+// need no Increment
+template <bool kViterbi>
+struct AddCount {
+  template <class Table>
+  static void Run(Table* s2t, unsigned e, unsigned f, double x) {
+    s2t->Increment(e, f, x);
+  }
+};
+template <>
+struct AddCount<true> {
+  template <class Table>
+  static void Run(Table*, unsigned, unsigned, double) {}
+};
+
+template <bool kUseNull, bool kDiagonal, bool kViterbi, bool kSafeProbs,
+          class Table = TTable>
+struct Posterior {
+  static double Prob(const Table& s2t, unsigned e, unsigned f) {
+    return kSafeProbs ? s2t.safe_prob(e, f) : s2t.prob(e, f);
+  }
+
+  // returns log p(trg | src). When counting, the posteriors, times weight
+  // (the number of copies of the pair in the corpus), are added to s2t and
+  // totals; when decoding, (*viterbi)[j] is set to the best source
+  // position of target word j, 1-based, or 0 for NULL. totals may be NULL
+  // when decoding. When counting, viterbi may be NULL; otherwise the links
+  // are decoded from the same posteriors as well.
+  static double Run(const std::vector<unsigned>& src,
+                    const std::vector<unsigned>& trg, double weight,
+                    const PosteriorOptions& opts, Table* s2t,
+                    std::vector<double>* probs_buf, PosteriorTotals* totals,
+                    std::vector<unsigned>* viterbi) {
+    const unsigned n = src.size();
+    const unsigned m = trg.size();
+    probs_buf->resize(n + 1);
+    double* probs = &(*probs_buf)[0];
+    if (viterbi) viterbi->resize(m);
+    const double prob_align_not_null = 1.0 - opts.prob_align_null;
+    const double tension = opts.diagonal_tension;
+    double likelihood = 0;
+    for (unsigned j = 0; j < m; ++j) {
+      const unsigned f_j = trg[j];
+      double sum = 0;
+      double prob_a_i = 1.0 / (n + kUseNull);  // uniform (model 1)
+      if (kUseNull) {
+        if (kDiagonal)
+          prob_a_i = opts.prob_align_null;
+        probs[0] = Prob(*s2t, opts.kNULL, f_j) * prob_a_i;
+        sum += probs[0];
+      }
+      double az = 0;
+      unsigned lo = 1, hi = n;
+      const bool banded = kDiagonal && opts.band_epsilon > 0;
+      if (kDiagonal) {
+        const double z = DiagonalAlignment::ComputeZ(j + 1, m, n, tension);
+        az = z / prob_align_not_null;
+        if (banded)
+          DiagonalAlignment::Window(j + 1, m, n, tension, z,
+              opts.band_epsilon, &lo, &hi);
+      }
+      double band_prior = 0;
+      for (unsigned i = lo; i <= hi; ++i) {
+        if (kDiagonal)
+          prob_a_i = DiagonalAlignment::UnnormalizedProb(j + 1, i, m, n,
+              tension) / az;
+        if (banded) band_prior += prob_a_i;
+        probs[i] = Prob(*s2t, src[i - 1], f_j) * prob_a_i;
+        sum += probs[i];
+      }
+      if (totals) {
+        totals->cells += hi - lo + 1 + kUseNull;
+        if (banded)
+          totals->dropped_prior = std::max(totals->dropped_prior,
+              1.0 - band_prior / prob_align_not_null);
+      }
+      if (kViterbi || viterbi) {
+        double max_p = -1;
+        unsigned max_index = 0;
+        if (kUseNull)
+          max_p = probs[0];
+        for (unsigned i = lo; i <= hi; ++i) {
+          if (probs[i] > max_p) {
+            max_index = i;
+            max_p = probs[i];
+          }
+        }
+        (*viterbi)[j] = max_index;
+      }
+      if (!kViterbi) {
+        if (kUseNull) {
+          const double count = probs[0] / sum * weight;
+          totals->c0 += count;
+          AddCount<kViterbi>::Run(s2t, opts.kNULL, f_j, count);
+        }
+        for (unsigned i = lo; i <= hi; ++i) {
+          const double p = probs[i] / sum * weight;
+          AddCount<kViterbi>::Run(s2t, src[i - 1], f_j, p);
+          totals->emp_feat += DiagonalAlignment::Feature(j, i, m, n) * p;
+        }
+      }
+      likelihood += std::log(sum);
+    }
+    return likelihood;
+  }
+};
+
+typedef double (*PosteriorFn)(const std::vector<unsigned>& src,
+                              const std::vector<unsigned>& trg, double weight,
+                              const PosteriorOptions& opts, TTable* s2t,
+                              std::vector<double>* probs_buf,
+                              PosteriorTotals* totals,
+                              std::vector<unsigned>* viterbi);
+
+// picks the variant for the given flags (once per batch, not per cell)
+inline PosteriorFn SelectPosterior(bool use_null, bool diagonal, bool viterbi,
+                                   bool safe_probs) {
+  static const PosteriorFn fns[16] = {
+    &Posterior<false, false, false, false>::Run,
+    &Posterior<false, false, false, true>::Run,
+    &Posterior<false, false, true, false>::Run,
+    &Posterior<false, false, true, true>::Run,
+    &Posterior<false, true, false, false>::Run,
+    &Posterior<false, true, false, true>::Run,
+    &Posterior<false, true, true, false>::Run,
+    &Posterior<false, true, true, true>::Run,
+    &Posterior<true, false, false, false>::Run,
+    &Posterior<true, false, false, true>::Run,
+    &Posterior<true, false, true, false>::Run,
+    &Posterior<true, false, true, true>::Run,
+    &Posterior<true, true, false, false>::Run,
+    &Posterior<true, true, false, true>::Run,
+    &Posterior<true, true, true, false>::Run,
+    &Posterior<true, true, true, true>::Run,
+  };
+  return fns[use_null * 8 + diagonal * 4 + viterbi * 2 + safe_probs];
+}
+
+// decoding with a compact model
+typedef double (*CompactPosteriorFn)(const std::vector<unsigned>& src,
+                                     const std::vector<unsigned>& trg,
+                                     double weight,
+                                     const PosteriorOptions& opts,
+                                     const CompactTTable* s2t,
+                                     std::vector<double>* probs_buf,
+                                     PosteriorTotals* totals,
+                                     std::vector<unsigned>* viterbi);
+
+inline CompactPosteriorFn SelectCompactPosterior(bool use_null,
+                                                 bool diagonal) {
+  static const CompactPosteriorFn fns[4] = {
+    &Posterior<false, false, true, true, const CompactTTable>::Run,
+    &Posterior<false, true, true, true, const CompactTTable>::Run,
+    &Posterior<true, false, true, true, const CompactTTable>::Run,
+    &Posterior<true, true, true, true, const CompactTTable>::Run,
+  };
+  return fns[use_null * 2 + diagonal];
+}
+
+#endif
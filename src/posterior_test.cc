@@ -0,0 +1,277 @@
+// Checks the templated posterior engine (posterior.h) against the loops it
+// replaced: the E-step and Viterbi pass of UpdateFromPairs and the forced
+// alignment loop of fast_align, kept here as they were. Every variant
+// (with and without NULL, uniform or diagonal prior, counting or decoding,
+// prob or safe_prob) runs a few EM iterations (plain and variational Bayes)
+// on a synthetic corpus next to the old code, and the likelihoods, expected
+// counts, parameters and links must come out bit-identical.
+//
+//   posterior_test [lines]    exit status 1 on a mismatch
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "src/corpus.h"
+#include "src/da.h"
+#include "src/posterior.h"
+#include "src/synthetic_corpus.h"
+#include "src/ttables.h"
+
+using namespace std;
+
+struct Sentence {
+  vector<unsigned> src, trg;
+};
+
+struct Settings {
+  bool use_null;
+  bool favor_diagonal;
+  unsigned kNULL;
+  double prob_align_null;
+  double diagonal_tension;
+};
+
+// the per-sentence loop of UpdateFromPairs before posterior.h; links[j] is
+// the source position printed for target word j (1-based), or 0 if none
+double OldUpdateFromPair(const Settings& g, const Sentence& s,
+                         bool final_iteration, TTable* s2t, double* c0_,
+                         double* emp_feat_, vector<int>* links) {
+  const vector<unsigned>& src = s.src;
+  const vector<unsigned>& trg = s.trg;
+  const bool use_null = g.use_null;
+  const bool favor_diagonal = g.favor_diagonal;
+  const unsigned kNULL = g.kNULL;
+  const double prob_align_null = g.prob_align_null;
+  const double prob_align_not_null = 1.0 - prob_align_null;
+  const double diagonal_tension = g.diagonal_tension;
+  links->assign(trg.size(), 0);
+  vector<double> probs(src.size() + 1);
+  double local_likelihood = 0.0;
+  for (unsigned j = 0; j < trg.size(); ++j) {
+    const unsigned& f_j = trg[j];
+    double sum = 0;
+    double prob_a_i = 1.0 / (src.size() + use_null);  // uniform (model 1)
+    if (use_null) {
+      if (favor_diagonal)
+        prob_a_i = prob_align_null;
+      probs[0] = s2t->prob(kNULL, f_j) * prob_a_i;
+      sum += probs[0];
+    }
+    double az = 0;
+    if (favor_diagonal)
+      az = DiagonalAlignment::ComputeZ(j + 1, trg.size(), src.size(),
+          diagonal_tension) / prob_align_not_null;
+    for (unsigned i = 1; i <= src.size(); ++i) {
+      if (favor_diagonal)
+        prob_a_i = DiagonalAlignment::UnnormalizedProb(j + 1, i, trg.size(),
+            src.size(), diagonal_tension) / az;
+      probs[i] = s2t->prob(src[i - 1], f_j) * prob_a_i;
+      sum += probs[i];
+    }
+    if (final_iteration) {
+      double max_p = -1;
+      int max_index = -1;
+      if (use_null) {
+        max_index = 0;
+        max_p = probs[0];
+      }
+      for (unsigned i = 1; i <= src.size(); ++i) {
+        if (probs[i] > max_p) {
+          max_index = i;
+          max_p = probs[i];
+        }
+      }
+      if (max_index > 0) (*links)[j] = max_index;
+    } else {
+      if (use_null) {
+        double count = probs[0] / sum;
+        *c0_ += count;
+        s2t->Increment(kNULL, f_j, count);
+      }
+      for (unsigned i = 1; i <= src.size(); ++i) {
+        const double p = probs[i] / sum;
+        s2t->Increment(src[i - 1], f_j, p);
+        *emp_feat_ += DiagonalAlignment::Feature(j, i, trg.size(), src.size()) * p;
+      }
+    }
+    local_likelihood += log(sum);
+  }
+  return local_likelihood;
+}
+
+// the forced alignment loop of fast_align -f before posterior.h
+double OldForceAlign(const Settings& g, const Sentence& s, const TTable& s2t,
+                     vector<int>* links) {
+  const vector<unsigned>& src = s.src;
+  const vector<unsigned>& trg = s.trg;
+  const bool use_null = g.use_null;
+  const bool favor_diagonal = g.favor_diagonal;
+  const double prob_align_not_null = 1.0 - g.prob_align_null;
+  links->assign(trg.size(), 0);
+  double log_prob = 0;
+  for (unsigned j = 0; j < trg.size(); ++j) {
+    unsigned f_j = trg[j];
+    double sum = 0;
+    int a_j = 0;
+    double max_pat = 0;
+    double prob_a_i = 1.0 / (src.size() + use_null);  // uniform (model 1)
+    if (use_null) {
+      if (favor_diagonal) prob_a_i = g.prob_align_null;
+      max_pat = s2t.safe_prob(g.kNULL, f_j) * prob_a_i;
+      sum += max_pat;
+    }
+    double az = 0;
+    if (favor_diagonal)
+      az = DiagonalAlignment::ComputeZ(j+1, trg.size(), src.size(), g.diagonal_tension) / prob_align_not_null;
+    for (unsigned i = 1; i <= src.size(); ++i) {
+      if (favor_diagonal)
+        prob_a_i = DiagonalAlignment::UnnormalizedProb(j + 1, i, trg.size(), src.size(), g.diagonal_tension) / az;
+      double pat = s2t.safe_prob(src[i-1], f_j) * prob_a_i;
+      if (pat > max_pat) { max_pat = pat; a_j = i; }
+      sum += pat;
+    }
+    log_prob += log(sum);
+    (*links)[j] = a_j;
+  }
+  return log_prob;
+}
+
+unsigned mismatches = 0;
+
+void Expect(bool ok, const char* what, const string& variant) {
+  if (ok) return;
+  if (++mismatches <= 20) cerr << variant << ": " << what << " differs\n";
+}
+
+// links of the engine (0 = NULL) against those of the old code
+bool SameLinks(const vector<unsigned>& viterbi, const vector<int>& old) {
+  if (viterbi.size() != old.size()) return false;
+  for (unsigned j = 0; j < old.size(); ++j)
+    if (static_cast<int>(viterbi[j]) != old[j]) return false;
+  return true;
+}
+
+void Build(const vector<Sentence>& corpus, const Settings& g, TTable* s2t) {
+  for (const Sentence& s : corpus) {
+    for (unsigned f : s.trg) {
+      if (g.use_null) s2t->Insert(g.kNULL, f);
+      for (unsigned e : s.src) s2t->Insert(e, f);
+    }
+  }
+  s2t->Freeze();
+}
+
+void CheckVariant(const vector<Sentence>& corpus,
+                  const vector<Sentence>& unseen, const Settings& g, bool vb) {
+  const string variant = string("posterior") + (g.use_null ? "_null" : "") +
+      (g.favor_diagonal ? "_diagonal" : "") + (vb ? "_vb" : "");
+  const unsigned before = mismatches;
+  TTable old_t, new_t;
+  Build(corpus, g, &old_t);
+  Build(corpus, g, &new_t);
+  PosteriorOptions opts;
+  opts.kNULL = g.kNULL;
+  opts.prob_align_null = g.prob_align_null;
+  opts.diagonal_tension = g.diagonal_tension;
+  vector<double> probs;
+  vector<unsigned> viterbi;
+  vector<int> old_links;
+  const PosteriorFn count =
+      SelectPosterior(g.use_null, g.favor_diagonal, false, false);
+  for (int iter = 0; iter < 3; ++iter) {
+    double c0 = 0, emp_feat = 0;
+    PosteriorTotals totals;
+    for (const Sentence& s : corpus) {
+      const double want = OldUpdateFromPair(g, s, false, &old_t, &c0,
+                                            &emp_feat, &old_links);
+      const double got = count(s.src, s.trg, 1.0, opts, &new_t, &probs, &totals,
+                               &viterbi);
+      Expect(got == want, "E-step likelihood", variant);
+    }
+    Expect(totals.c0 == c0, "expected NULL links", variant);
+    Expect(totals.emp_feat == emp_feat, "expected diagonal feature", variant);
+    if (vb) {
+      old_t.NormalizeVB(0.01);
+      new_t.NormalizeVB(0.01);
+    } else {
+      old_t.Normalize();
+      new_t.Normalize();
+    }
+    bool same = true;
+    for (const Sentence& s : corpus) {
+      for (unsigned f : s.trg) {
+        if (g.use_null)
+          same = same && old_t.prob(g.kNULL, f) == new_t.prob(g.kNULL, f);
+        for (unsigned e : s.src)
+          same = same && old_t.prob(e, f) == new_t.prob(e, f);
+      }
+    }
+    Expect(same, "parameters", variant);
+  }
+  // the final Viterbi pass of training
+  const PosteriorFn decode =
+      SelectPosterior(g.use_null, g.favor_diagonal, true, false);
+  for (const Sentence& s : corpus) {
+    double c0 = 0, emp_feat = 0;
+    const double want = OldUpdateFromPair(g, s, true, &old_t, &c0, &emp_feat,
+                                          &old_links);
+    const double got = decode(s.src, s.trg, 1.0, opts, &new_t, &probs, NULL,
+                              &viterbi);
+    Expect(got == want, "Viterbi likelihood", variant);
+    Expect(SameLinks(viterbi, old_links), "Viterbi links", variant);
+  }
+  // forced alignment, also of words and pairs the model doesn't have
+  const PosteriorFn force =
+      SelectPosterior(g.use_null, g.favor_diagonal, true, true);
+  for (const vector<Sentence>* c : { &corpus, &unseen }) {
+    for (const Sentence& s : *c) {
+      const double want = OldForceAlign(g, s, old_t, &old_links);
+      const double got = force(s.src, s.trg, 1.0, opts, &new_t, &probs, NULL,
+                               &viterbi);
+      Expect(got == want, "forced alignment likelihood", variant);
+      Expect(SameLinks(viterbi, old_links), "forced alignment links",
+             variant);
+    }
+  }
+  cout << variant << ": " << (mismatches == before ? "ok" : "MISMATCH")
+       << endl;
+}
+
+int main(int argc, char** argv) {
+  const int num_lines = argc > 1 ? atoi(argv[1]) : 500;
+  SyntheticCorpus::Options corpus_opts;
+  corpus_opts.vocab_size = 2000;  // small enough for a dense NULL row
+  SyntheticCorpus gen(corpus_opts);
+  Dict d;
+  const unsigned kDIV = d.Convert("|||");
+  Settings g;
+  g.kNULL = d.Convert("<eps>");
+  g.prob_align_null = 0.08;
+  g.diagonal_tension = 4.0;
+  vector<Sentence> corpus(num_lines), unseen;
+  vector<unsigned> tmp;
+  for (Sentence& s : corpus) {
+    d.ConvertWhitespaceDelimitedLine(gen.NextLine(), kDIV, &tmp);
+    vector<unsigned>::iterator div = find(tmp.begin(), tmp.end(), kDIV);
+    s.src.assign(tmp.begin(), div);
+    s.trg.assign(div + 1, tmp.end());
+  }
+  // the same sentences paired differently, with a few new words
+  for (int k = 0; k + 1 < num_lines; k += 10) {
+    Sentence s;
+    s.src = corpus[k].src;
+    s.trg = corpus[k + 1].trg;
+    s.src.push_back(d.Convert("unseen-source-word"));
+    s.trg.push_back(d.Convert("unseen-target-word"));
+    unseen.push_back(s);
+  }
+  for (int v = 0; v < 8; ++v) {
+    g.use_null = v & 4;
+    g.favor_diagonal = v & 2;
+    CheckVariant(corpus, unseen, g, v & 1);
+  }
+  return mismatches ? 1 : 0;
+}
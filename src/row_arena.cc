@@ -0,0 +1,99 @@
+#include "src/row_arena.h"
+
+#include <cassert>
+#include <new>
+
+using namespace std;
+
+RowArena::RowArena(size_t chunk_bytes) :
+    chunk_bytes_(RoundUp(chunk_bytes)), cur_(NULL), end_(NULL),
+    released_(false), discard_frees_(false) {}
+
+void RowArena::NewChunk(size_t bytes) {
+  char* c = static_cast<char*>(::operator new(bytes));
+  chunks_.push_back(c);
+  cur_ = c;
+  end_ = c + bytes;
+  stats_.bytes_reserved += bytes;
+  ++stats_.chunks;
+}
+
+void* RowArena::Allocate(size_t bytes) {
+  bytes = RoundUp(bytes);
+  lock_guard<mutex> lock(mutex_);
+  assert(!released_);
+  ++stats_.allocations;
+  stats_.bytes_in_use += bytes;
+  if (bytes > chunk_bytes_ / 4 && static_cast<size_t>(end_ - cur_) < bytes) {
+    void* p = ::operator new(bytes);
+    large_.insert(p);
+    stats_.bytes_reserved += bytes;
+    ++stats_.large_blocks;
+    return p;
+  }
+  unordered_map<size_t, void*>::iterator fl = free_lists_.find(bytes);
+  if (fl != free_lists_.end() && fl->second) {
+    void* p = fl->second;
+    fl->second = *static_cast<void**>(p);
+    stats_.bytes_free_listed -= bytes;
+    return p;
+  }
+  if (static_cast<size_t>(end_ - cur_) < bytes)
+    NewChunk(chunk_bytes_);
+  void* p = cur_;
+  cur_ += bytes;
+  return p;
+}
+
+void RowArena::Free(void* p, size_t bytes) {
+  if (discard_frees_) return;
+  bytes = RoundUp(bytes);
+  lock_guard<mutex> lock(mutex_);
+  if (released_) return;
+  stats_.bytes_in_use -= bytes;
+  if (large_.erase(p)) {
+    ::operator delete(p);
+    stats_.bytes_reserved -= bytes;
+    --stats_.large_blocks;
+    return;
+  }
+  void*& head = free_lists_[bytes];
+  *static_cast<void**>(p) = head;
+  head = p;
+  stats_.bytes_free_listed += bytes;
+}
+
+void* RowArena::Carve(size_t bytes) {
+  bytes = RoundUp(bytes);
+  lock_guard<mutex> lock(mutex_);
+  assert(!released_);
+  ++stats_.allocations;
+  stats_.bytes_in_use += bytes;
+  if (static_cast<size_t>(end_ - cur_) < bytes)
+    NewChunk(bytes > chunk_bytes_ ? bytes : chunk_bytes_);
+  void* p = cur_;
+  cur_ += bytes;
+  return p;
+}
+
+void RowArena::Release() {
+  lock_guard<mutex> lock(mutex_);
+  for (size_t i = 0; i < chunks_.size(); ++i)
+    ::operator delete(chunks_[i]);
+  for (unordered_set<void*>::iterator it = large_.begin(); it != large_.end(); ++it)
+    ::operator delete(*it);
+  chunks_.clear();
+  large_.clear();
+  free_lists_.clear();
+  cur_ = end_ = NULL;
+  released_ = true;
+  discard_frees_ = false;
+  const size_t allocations = stats_.allocations;
+  stats_ = Stats();
+  stats_.allocations = allocations;
+}
+
+RowArena::Stats RowArena::stats() const {
+  lock_guard<mutex> lock(mutex_);
+  return stats_;
+}
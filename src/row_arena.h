@@ -0,0 +1,68 @@
+#ifndef ROW_ARENA_H_
+#define ROW_ARENA_H_
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Slab allocator for the storage blocks of translation table rows. Blocks
+// are carved out of large chunks and recycled through per-size free lists;
+// a block bigger than a quarter chunk gets its own allocation unless it fits
+// in what is left of the current chunk.
+// Everything is returned to the system at once when the arena is released
+// or destroyed. All methods are thread safe.
+class RowArena {
+ public:
+  struct Stats {
+    Stats() : bytes_reserved(), bytes_in_use(), bytes_free_listed(),
+      chunks(), large_blocks(), allocations() {}
+    size_t bytes_reserved;     // chunks plus large blocks held from the system
+    size_t bytes_in_use;       // live blocks
+    size_t bytes_free_listed;  // freed blocks waiting for reuse
+    size_t chunks;
+    size_t large_blocks;
+    size_t allocations;        // total calls to Allocate()
+  };
+
+  explicit RowArena(size_t chunk_bytes = 1 << 22);
+  ~RowArena() { Release(); }
+
+  // the size of the block Allocate(bytes) hands out
+  static size_t RoundUp(size_t bytes) { return (bytes + 15) & ~size_t(15); }
+
+  void* Allocate(size_t bytes);
+  void Free(void* p, size_t bytes);
+  // `bytes` contiguous bytes in one go, for the caller to split into blocks
+  // of RoundUp() sizes without going through the lock for each; they may be
+  // Free()d one by one like any other blocks
+  void* Carve(size_t bytes);
+  // from now on Free() returns at once, without taking the lock, for
+  // dropping many blocks right before a Release(); not thread safe itself
+  void DiscardFrees() { discard_frees_ = true; }
+  // returns all memory to the system; blocks handed out earlier become
+  // invalid and Free() of them turns into a no-op. The arena can't be used
+  // again afterwards: Allocate() and Carve() assert against it
+  void Release();
+
+  Stats stats() const;
+
+ private:
+  RowArena(const RowArena&);
+  void operator=(const RowArena&);
+  void NewChunk(size_t bytes);
+
+  const size_t chunk_bytes_;
+  mutable std::mutex mutex_;
+  std::vector<char*> chunks_;
+  char* cur_;   // bump pointer into the last chunk
+  char* end_;
+  std::unordered_map<size_t, void*> free_lists_;  // block size -> first block
+  std::unordered_set<void*> large_;
+  bool released_;
+  bool discard_frees_;
+  Stats stats_;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include "src/run_stats.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sys/resource.h>
+
+using namespace std;
+
+static void WriteJsonString(const string& s, ostream* out) {
+  *out << '"';
+  for (size_t i = 0; i < s.size(); ++i) {
+    const unsigned char c = s[i];
+    switch (c) {
+      case '"':  *out << "\\\""; break;
+      case '\\': *out << "\\\\"; break;
+      case '\n': *out << "\\n"; break;
+      case '\t': *out << "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          *out << buf;
+        } else {
+          *out << c;
+        }
+    }
+  }
+  *out << '"';
+}
+
+static void WriteJsonNumber(double x, ostream* out) {
+  if (!std::isfinite(x)) {  // not representable in JSON
+    *out << "null";
+    return;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.10g", x);
+  *out << buf;
+}
+
+StatsRecord::Entry* StatsRecord::Find(const string& key) {
+  for (size_t i = 0; i < entries_.size(); ++i)
+    if (entries_[i].key == key) return &entries_[i];
+  entries_.push_back(Entry());
+  entries_.back().key = key;
+  entries_.back().is_string = false;
+  entries_.back().number = 0;
+  return &entries_.back();
+}
+
+void StatsRecord::Set(const string& key, double value) {
+  Entry* e = Find(key);
+  e->is_string = false;
+  e->number = value;
+}
+
+void StatsRecord::Set(const string& key, const string& value) {
+  Entry* e = Find(key);
+  e->is_string = true;
+  e->str = value;
+}
+
+void StatsRecord::Add(const string& key, double value) {
+  Entry* e = Find(key);
+  e->number += value;
+}
+
+double StatsRecord::Get(const string& key) const {
+  for (size_t i = 0; i < entries_.size(); ++i)
+    if (entries_[i].key == key) return entries_[i].number;
+  return 0;
+}
+
+void StatsRecord::WriteJson(ostream* out, int indent) const {
+  const bool one_line = indent < 0;
+  const string pad(one_line ? 0 : indent + 2, ' ');
+  *out << '{';
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (one_line)
+      *out << (i ? ", " : "");
+    else
+      *out << (i ? ",\n" : "\n") << pad;
+    WriteJsonString(entries_[i].key, out);
+    *out << ": ";
+    if (entries_[i].is_string)
+      WriteJsonString(entries_[i].str, out);
+    else
+      WriteJsonNumber(entries_[i].number, out);
+  }
+  if (!entries_.empty() && !one_line) *out << '\n' << string(indent, ' ');
+  *out << '}';
+}
+
+long RunStats::PeakRssKb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return usage.ru_maxrss;  // kilobytes on Linux
+}
+
+bool RunStats::WriteJsonFile(const string& filename) const {
+  ofstream out(filename.c_str());
+  if (!out) return false;
+  out << "{\n  \"params\": ";
+  params.WriteJson(&out, 2);
+  out << ",\n  \"corpus\": ";
+  corpus.WriteJson(&out, 2);
+  out << ",\n  \"model\": ";
+  model.WriteJson(&out, 2);
+  out << ",\n  \"phases\": ";
+  phases.WriteJson(&out, 2);
+  out << ",\n  \"iterations\": [";
+  for (size_t i = 0; i < iterations.size(); ++i) {
+    out << (i ? ",\n    " : "\n    ");
+    iterations[i].WriteJson(&out, 4);
+  }
+  if (!iterations.empty()) out << "\n  ";
+  out << "],\n  \"total_seconds\": ";
+  WriteJsonNumber(total.Elapsed(), &out);
+  out << ",\n  \"peak_rss_kb\": " << PeakRssKb() << "\n}\n";
+  return static_cast<bool>(out);
+}
@@ -0,0 +1,68 @@
+#ifndef RUN_STATS_H_
+#define RUN_STATS_H_
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// wall-clock stopwatch
+class Timer {
+ public:
+  Timer() : start_(std::chrono::steady_clock::now()) {}
+  double Elapsed() const {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start_).count();
+  }
+  // returns the elapsed time and restarts the timer
+  double Lap() {
+    const double e = Elapsed();
+    start_ = std::chrono::steady_clock::now();
+    return e;
+  }
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+// ordered set of named numbers and strings, written as one JSON object
+class StatsRecord {
+ public:
+  void Set(const std::string& key, double value);
+  void Set(const std::string& key, const std::string& value);
+  void Set(const std::string& key, const char* value) {
+    Set(key, std::string(value));
+  }
+  // adds value to a numeric entry (created as 0 if missing)
+  void Add(const std::string& key, double value);
+  double Get(const std::string& key) const;
+  bool empty() const { return entries_.empty(); }
+  // indent < 0 writes the object on a single line
+  void WriteJson(std::ostream* out, int indent) const;
+
+ private:
+  struct Entry {
+    std::string key;
+    bool is_string;
+    double number;
+    std::string str;
+  };
+  Entry* Find(const std::string& key);
+  std::vector<Entry> entries_;
+};
+
+// Timings, throughput and model statistics of one run, written as a JSON
+// file so that runs can be tracked and hyperparameters read back reliably.
+struct RunStats {
+  StatsRecord params;   // hyperparameters, including learned ones
+  StatsRecord phases;   // seconds spent per phase, summed over the run
+  StatsRecord corpus;
+  StatsRecord model;
+  std::vector<StatsRecord> iterations;
+  Timer total;
+
+  // peak resident set size of this process so far, in kilobytes
+  static long PeakRssKb();
+  bool WriteJsonFile(const std::string& filename) const;
+};
+
+#endif
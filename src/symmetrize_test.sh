@@ -0,0 +1,49 @@
+#!/bin/sh
+# Runs every symmetrization heuristic of atools on the noisy forward and
+# reverse alignments of a small synthetic corpus (bench -g -A), in small
+# batches on several threads and from binary inputs, and compares the
+# output with symmetrize_test.expected. Every third reverse link is moved
+# to the next target word, so that the heuristics disagree. The expected
+# file was written by the atools that still built a grid per sentence and
+# ran one line at a time, on the same files:
+#   for h in $HEURISTICS; do echo "# $h"; atools -i fwd -j rev -c $h; done
+#
+#   symmetrize_test.sh BENCH ATOOLS EXPECTED    exit status 1 on a failure
+
+BENCH=$1
+ATOOLS=$2
+EXPECTED=$3
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+HEURISTICS="intersect union grow-diag grow-diag-final grow-diag-final-and"
+
+"$BENCH" -g -n 200 -V 2000 -l 10 -A "$T/syn" > /dev/null || exit 1
+cp "$T/syn.fwd" "$T/fwd"
+awk '{ for (k = 3; k <= NF; k += 3) { split($k, l, "-"); $k = l[1] "-" l[2] + 1 }
+       print }' "$T/syn.rev" > "$T/rev"
+"$ATOOLS" -i "$T/fwd" -c convert -B -o "$T/fwd.bin" || exit 1
+"$ATOOLS" -i "$T/rev" -c convert -B -o "$T/rev.bin" || exit 1
+
+failures=0
+# $1 = name, then the input options
+run() {
+  name=$1
+  shift
+  for h in $HEURISTICS; do
+    echo "# $h"
+    "$ATOOLS" "$@" -c $h
+  done > "$T/out"
+  if cmp -s "$EXPECTED" "$T/out"; then
+    echo "$name: ok"
+  else
+    echo "$name: FAILED"
+    diff "$EXPECTED" "$T/out" | head -5
+    failures=$((failures + 1))
+  fi
+}
+
+run symmetrize -i "$T/fwd" -j "$T/rev"
+run symmetrize_batches -i "$T/fwd" -j "$T/rev" -b 7 -t 3
+run symmetrize_binary -i "$T/fwd.bin" -j "$T/rev.bin" -b 7
+
+[ "$failures" -eq 0 ]
@@ -0,0 +1,113 @@
+#ifndef SYNTHETIC_CORPUS_H_
+#define SYNTHETIC_CORPUS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Deterministic generator of parallel corpora with a known word alignment,
+// for benchmarking. Source words are drawn from a Zipfian distribution;
+// each target word translates the source word near the diagonal position
+// (through a fixed word-to-word mapping) or, with probability noise, is a
+// Zipfian draw of its own. All random numbers come from a local xorshift
+// generator, so the same options produce the same corpus everywhere.
+class SyntheticCorpus {
+ public:
+  struct Options {
+    Options() : vocab_size(50000), zipf_exponent(1.0), mean_length(20),
+      max_length(100), length_ratio(1.0), noise(0.2), seed(1) {}
+    unsigned vocab_size;   // per language
+    double zipf_exponent;
+    double mean_length;    // of source sentences (Poisson)
+    unsigned max_length;
+    double length_ratio;   // expected target length / source length
+    double noise;          // probability of an untranslated target word
+    uint64_t seed;
+  };
+
+  explicit SyntheticCorpus(const Options& opts) :
+      opts_(opts), state_(opts.seed * 0x9E3779B97F4A7C15ULL + 1) {
+    cdf_.resize(opts.vocab_size);
+    double z = 0;
+    for (unsigned k = 0; k < opts.vocab_size; ++k) {
+      z += 1.0 / std::pow(k + 1.0, opts.zipf_exponent);
+      cdf_[k] = z;
+    }
+    for (unsigned k = 0; k < opts.vocab_size; ++k) cdf_[k] /= z;
+    translation_.resize(opts.vocab_size);
+    for (unsigned k = 0; k < opts.vocab_size; ++k)
+      translation_[k] = Next() % opts.vocab_size;
+  }
+
+  // next sentence pair; alignment gets the (source, target) links of the
+  // translated target words
+  void NextPair(std::vector<unsigned>* src, std::vector<unsigned>* trg,
+                std::vector<std::pair<unsigned, unsigned> >* alignment) {
+    src->clear();
+    trg->clear();
+    alignment->clear();
+    const unsigned n = Length(opts_.mean_length);
+    const unsigned m = Length(n * opts_.length_ratio);
+    for (unsigned i = 0; i < n; ++i) src->push_back(Zipf());
+    for (unsigned j = 0; j < m; ++j) {
+      if (Uniform() < opts_.noise) {
+        trg->push_back(Zipf());
+        continue;
+      }
+      // jitter of -1, 0 or +1 around the diagonal
+      int i = static_cast<int>((j + 0.5) * n / m) + static_cast<int>(Next() % 3) - 1;
+      i = std::max(0, std::min(static_cast<int>(n) - 1, i));
+      trg->push_back(translation_[(*src)[i]]);
+      alignment->push_back(std::make_pair(static_cast<unsigned>(i), j));
+    }
+  }
+
+  // next line in fast_align's input format
+  std::string NextLine() {
+    std::vector<unsigned> src, trg;
+    std::vector<std::pair<unsigned, unsigned> > a;
+    NextPair(&src, &trg, &a);
+    return FormatLine(src, trg);
+  }
+
+  // source word k is written as sk, target word k as tk
+  static std::string FormatLine(const std::vector<unsigned>& src,
+                                const std::vector<unsigned>& trg) {
+    std::ostringstream os;
+    for (unsigned i = 0; i < src.size(); ++i) os << (i ? " s" : "s") << src[i];
+    os << " |||";
+    for (unsigned j = 0; j < trg.size(); ++j) os << " t" << trg[j];
+    return os.str();
+  }
+
+  uint64_t Next() {  // xorshift64*
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 2685821657736338717ULL;
+  }
+  double Uniform() { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+
+ private:
+  unsigned Zipf() {
+    return std::lower_bound(cdf_.begin(), cdf_.end(), Uniform()) - cdf_.begin();
+  }
+  // 1 + Poisson(mean - 1), capped at max_length
+  unsigned Length(double mean) {
+    const double limit = std::exp(-std::max(mean - 1.0, 0.0));
+    unsigned k = 0;
+    for (double p = Uniform(); p > limit && k + 1 < opts_.max_length; p *= Uniform())
+      ++k;
+    return k + 1;
+  }
+
+  Options opts_;
+  uint64_t state_;
+  std::vector<double> cdf_;
+  std::vector<unsigned> translation_;
+};
+
+#endif
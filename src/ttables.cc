@@ -6,8 +6,10 @@
 
 #include "src/corpus.h"
 
-void TTable::DeserializeLogProbsFromText(std::istream* in, Dict& d) {
-  int c = 0;
+double TTable::dense_threshold = 0.25;
+
+size_t TTable::DeserializeLogProbsFromText(std::istream* in, Dict& d) {
+  size_t c = 0;
   std::string e, f;
   double p;
   while(*in) {
@@ -15,9 +17,12 @@ void TTable::DeserializeLogProbsFromText(std::istream* in, Dict& d) {
     if (e.empty()) break;
     ++c;
     unsigned ie = d.Convert(e);
-    if (ie >= ttable.size()) ttable.resize(ie + 1);
+    if (ie >= ttable.size()) ttable.resize(ie + 1, NewWord2Double(&arena_));
     ttable[ie][d.Convert(f)] = std::exp(p);
   }
-  std::cerr << "Loaded " << c << " translation parameters.\n";
+  dense_ttable_.resize(ttable.size());
+  dense_counts_.resize(ttable.size());
+  dense_row_of_.resize(ttable.size());
+  return c;
 }
 
@@ -15,14 +15,19 @@
 #ifndef _TTABLES_H_
 #define _TTABLES_H_
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <vector>
+#include <stdint.h>
 
+#include "src/count_min_sketch.h"
 #include "src/hashtables.h"
 #include "src/corpus.h"
+#include "src/vmath.h"
 
 struct Md {
   static double digamma(double x) {
@@ -44,17 +49,44 @@ struct Md {
 
 class TTable {
  public:
-  TTable() : frozen_(false), probs_initialized_(false) {}
+  TTable()
+      : tail_vb_(false), tail_alpha_(0), frozen_(false),
+        probs_initialized_(false) {}
+  ~TTable() {
+    // the rows don't need to hand their blocks back one by one
+    arena_.Release();
+    insert_arena_.Release();
+  }
 //  typedef std::unordered_map<unsigned, double> Word2Double;
 
   typedef std::vector<Word2Double> Word2Word2Double;
 
+  // rows with at least this fraction of the target words below their
+  // largest one (and kMinDenseEntries entries) are stored as plain arrays
+  // indexed by the target word after Freeze(); at 0.25 an array takes about
+  // the memory of a hash map with the same entries
+  static double dense_threshold;
+  static const size_t kMinDenseEntries = 1024;
+
   inline double prob(const unsigned e, const unsigned f) const {
-    return probs_initialized_ ? ttable[e].find(f)->second : 1e-9;
+    if (!probs_initialized_) return 1e-9;
+    if (!tail_counts_.empty()) return HybridProb(e, f);
+    const double* dense = dense_ttable_[e];
+    return dense ? dense[f] : ttable[e].find(f)->second;
   }
 
   inline double safe_prob(const int& e, const int& f) const {
+    if (!tail_counts_.empty()) {
+      if (!probs_initialized_ || e >= static_cast<int>(ttable.size()))
+        return 1e-9;
+      return HybridProb(e, f);
+    }
     if (e < static_cast<int>(ttable.size())) {
+      if (e < static_cast<int>(dense_ttable_.size()) && dense_ttable_[e]) {
+        const DenseRow& r = dense_row_of_[e];
+        if (f >= static_cast<int>(r.width) || !IsPresent(r, f)) return 1e-9;
+        return dense_ttable_[e][f];
+      }
       const Word2Double& cpd = ttable[e];
       const Word2Double::const_iterator it = cpd.find(f);
       if (it == cpd.end()) return 1e-9;
@@ -66,113 +98,558 @@ class TTable {
 
   inline void SetMaxE(const unsigned e) {
     // NOT thread safe
+    assert(!frozen_);  // Freeze() has released insert_arena_
     if (e >= counts.size())
-        counts.resize(e + 1);
+        counts.resize(e + 1, NewWord2Double(&insert_arena_));
   }
 
   inline void Insert(const unsigned e, const unsigned f) {
     // NOT thread safe
+    assert(!frozen_);
     if (e >= counts.size())
-        counts.resize(e + 1);
+        counts.resize(e + 1, NewWord2Double(&insert_arena_));
     counts[e][f] = 0;
   }
 
   inline void Increment(const unsigned e, const unsigned f, const double x) {
-    counts[e].find(f)->second += x; // Ignore race conditions here.
+    // Ignore race conditions here.
+    if (!tail_counts_.empty()) {
+      HybridIncrement(e, f, x);
+      return;
+    }
+    double* dense = dense_counts_[e];
+    if (dense)
+      dense[f] += x;
+    else
+      counts[e].find(f)->second += x;
   }
 
+  // Hybrid mode: the pairs that are not Insert()ed (the rare ones) share a
+  // count-min sketch of width x depth counters per table instead of having
+  // entries of their own. Their expected counts go to the sketch and their
+  // probabilities are its estimates over the row totals, so they are
+  // approximate (an overestimate within the sketch's error bound), and
+  // ExportToFile leaves them out. Call before Freeze().
+  void EnableTail(size_t width, unsigned depth) {
+    tail_counts_.Init(width, depth);
+    tail_probs_.Init(width, depth);
+  }
+  // with VB, the Dirichlet prior of a row covers its sketched pairs as
+  // well: n of them are added to row e (an estimate of their number)
+  void AddTailEntries(const unsigned e, const double n) {
+    // NOT thread safe
+    if (e >= tail_entries_.size()) tail_entries_.resize(e + 1, 0);
+    tail_entries_[e] += n;
+  }
+  bool has_tail() const { return !tail_counts_.empty(); }
+  const CountMinSketch<float>& tail() const { return tail_counts_; }
+
   void NormalizeVB(const double alpha) {
     ttable.swap(counts);
-#pragma omp parallel for schedule(dynamic)
-    for (unsigned i = 0; i < ttable.size(); ++i) {
-      double tot = 0;
-      Word2Double& cpd = ttable[i];
-      for (Word2Double::iterator it = cpd.begin(); it != cpd.end(); ++it)
-        tot += it->second + alpha;
-      if (!tot) tot = 1;
-      const double digamma_tot = Md::digamma(tot);
-      for (Word2Double::iterator it = cpd.begin(); it != cpd.end(); ++it)
-        it->second = exp(Md::digamma(it->second + alpha) - digamma_tot);
+    dense_ttable_.swap(dense_counts_);
+    std::vector<double> totals(spans_.size());
+#pragma omp parallel
+    {
+      std::vector<double> buf;
+#pragma omp for schedule(dynamic)
+      for (unsigned k = 0; k < spans_.size(); ++k) {
+        const Span& s = spans_[k];
+        if (s.split) {
+          totals[k] = Sum(s.row, s.first, s.last, alpha);
+          continue;
+        }
+        for (unsigned i = s.row; i < s.row_end; ++i) {
+          double tot = Sum(i, 0, Slots(i), alpha) + TailTotal(i, alpha);
+          if (!tot) tot = 1;
+          SetTailNorm(i, VMath::Digamma(tot));
+          DigammaExp(i, 0, Slots(i), alpha, VMath::Digamma(tot), &buf);
+        }
+      }
+      // the pieces of the big rows, once their totals are known
+#pragma omp single
+      RowTotals(alpha, &totals);
+#pragma omp for schedule(dynamic)
+      for (unsigned k = 0; k < spans_.size(); ++k) {
+        const Span& s = spans_[k];
+        if (s.split)
+          DigammaExp(s.row, s.first, s.last, alpha,
+                     VMath::Digamma(totals[k] ? totals[k] : 1), &buf);
+      }
     }
     ClearCounts();
+    SwapTail(true, alpha);
     probs_initialized_ = true;
   }
 
   void Normalize() {
     ttable.swap(counts);
-#pragma omp parallel for schedule(dynamic)
-    for (unsigned i = 0; i < ttable.size(); ++i) {
-      double tot = 0;
-      Word2Double& cpd = ttable[i];
-      for (Word2Double::iterator it = cpd.begin(); it != cpd.end(); ++it)
-        tot += it->second;
-      if (!tot) tot = 1;
-      for (Word2Double::iterator it = cpd.begin(); it != cpd.end(); ++it)
-        it->second /= tot;
+    dense_ttable_.swap(dense_counts_);
+    std::vector<double> totals(spans_.size());
+#pragma omp parallel
+    {
+#pragma omp for schedule(dynamic)
+      for (unsigned k = 0; k < spans_.size(); ++k) {
+        const Span& s = spans_[k];
+        if (s.split) {
+          totals[k] = Sum(s.row, s.first, s.last, 0);
+          continue;
+        }
+        for (unsigned i = s.row; i < s.row_end; ++i) {
+          double tot = Sum(i, 0, Slots(i), 0) + TailTotal(i, 0);
+          if (!tot) tot = 1;
+          SetTailNorm(i, 1 / tot);
+          Divide(i, 0, Slots(i), tot);
+        }
+      }
+#pragma omp single
+      RowTotals(0, &totals);
+#pragma omp for schedule(dynamic)
+      for (unsigned k = 0; k < spans_.size(); ++k) {
+        const Span& s = spans_[k];
+        if (s.split)
+          Divide(s.row, s.first, s.last, totals[k] ? totals[k] : 1);
+      }
     }
     ClearCounts();
+    SwapTail(false, 0);
     probs_initialized_ = true;
   }
 
   void Freeze() {
     // duplicate all values in counts into ttable
     // later updates to both are semi-threadsafe
+    // Both copies of each row are compacted into one bulk allocation, cut
+    // up in advance (the two copies of a row end up next to each other),
+    // and the fragmented storage the rows grew in is dropped without
+    // recycling its blocks and returned in one go. So the threads copying
+    // the rows in parallel never wait for the arenas, and under the
+    // default first-touch policy the pages are spread over the NUMA nodes
+    // of the threads.
     assert (!frozen_);
     if (!frozen_) {
-      ttable.resize(counts.size());
+      MakeDenseRows();
+      std::vector<size_t> offset(counts.size() + 1, 0);
+      for (unsigned i = 0; i < counts.size(); ++i)
+        offset[i + 1] = offset[i] +
+            2 * RowArena::RoundUp(CompactWord2DoubleBytes(counts[i]));
+      char* block = offset.back() ?
+          static_cast<char*>(arena_.Carve(offset.back())) : NULL;
+      ttable.resize(counts.size(), NewWord2Double(&arena_));
+      insert_arena_.DiscardFrees();
+#pragma omp parallel for schedule(static)
       for (unsigned i = 0; i < counts.size(); ++i) {
-        ttable[i] = counts[i];
+        const size_t half = (offset[i + 1] - offset[i]) / 2;
+        char* t = half ? block + offset[i] : NULL;
+        CompactWord2Double(counts[i], &arena_, t, &ttable[i]);
+        Word2Double compact;
+        CompactWord2Double(counts[i], &arena_, half ? t + half : NULL,
+                           &compact);
+        counts[i].swap(compact);
+      }
+      insert_arena_.Release();
+      MakeSpans();
+      if (!tail_counts_.empty()) {
+        tail_totals_.assign(counts.size(), 0);
+        tail_norm_.assign(counts.size(), 0);
+        tail_entries_.resize(counts.size(), 0);
       }
     }
     frozen_ = true;
   }
   // adds counts from another TTable - probabilities remain unchanged
   TTable& operator+=(const TTable& rhs) {
-    if (rhs.counts.size() > counts.size()) counts.resize(rhs.counts.size());
+    if (rhs.counts.size() > counts.size())
+      counts.resize(rhs.counts.size(), NewWord2Double(&arena_));
     for (unsigned i = 0; i < rhs.counts.size(); ++i) {
-      const Word2Double& cpd = rhs.counts[i];
-      Word2Double& tgt = counts[i];
-      for (Word2Double::const_iterator j = cpd.begin(); j != cpd.end(); ++j) {
-        tgt[j->first] += j->second;
+      if (const double* dense = rhs.DenseCounts(i)) {
+        const DenseRow& r = rhs.dense_row_of_[i];
+        for (unsigned w = 0; w < Words(r.width); ++w) {
+          for (uint64_t bits = r.present[w]; bits; bits &= bits - 1) {
+            const unsigned f = 64 * w + __builtin_ctzll(bits);
+            AddCount(i, f, dense[f]);
+          }
+        }
       }
+      const Word2Double& cpd = rhs.counts[i];
+      for (Word2Double::const_iterator j = cpd.begin(); j != cpd.end(); ++j)
+        AddCount(i, j->first, j->second);
     }
     return *this;
   }
-  void ExportToFile(const char* filename, Dict& d, double BEAM_THRESHOLD) const {
-    std::ofstream file(filename);
+  // number of translation parameters
+  size_t num_entries() const {
+    const Word2Word2Double& t = ttable.empty() ? counts : ttable;
+    size_t n = 0;
+    for (size_t i = 0; i < t.size(); ++i)
+      n += t[i].size();
+    for (unsigned k = 0; k < dense_rows_.size(); ++k)
+      for (unsigned w = 0; w < Words(dense_rows_[k].width); ++w)
+        n += __builtin_popcountll(dense_rows_[k].present[w]);
+    return n;
+  }
+  size_t num_dense_rows() const { return dense_rows_.size(); }
+  // approximate bytes used by the probability and count tables
+  size_t memory_bytes() const {
+    size_t b = (ttable.capacity() + counts.capacity()) * sizeof(Word2Double);
+    for (size_t i = 0; i < ttable.size(); ++i)
+      b += Word2DoubleBytes(ttable[i]);
+    for (size_t i = 0; i < counts.size(); ++i)
+      b += Word2DoubleBytes(counts[i]);
+    for (unsigned k = 0; k < dense_rows_.size(); ++k)
+      b += 2 * dense_rows_[k].width * sizeof(double) +
+          Words(dense_rows_[k].width) * sizeof(uint64_t);
+    b += tail_memory_bytes();
+    return b;
+  }
+  // bytes of the sketches and the per row arrays of hybrid mode
+  size_t tail_memory_bytes() const {
+    return tail_counts_.memory_bytes() + tail_probs_.memory_bytes() +
+        (tail_totals_.capacity() + tail_norm_.capacity() +
+         tail_entries_.capacity()) * sizeof(double);
+  }
+  // storage statistics of the rows (only the flat map backend allocates
+  // rows from the arenas)
+  RowArena::Stats allocator_stats() const {
+    RowArena::Stats s = arena_.stats();
+    const RowArena::Stats t = insert_arena_.stats();
+    s.bytes_reserved += t.bytes_reserved;
+    s.bytes_in_use += t.bytes_in_use;
+    s.bytes_free_listed += t.bytes_free_listed;
+    s.chunks += t.chunks;
+    s.large_blocks += t.large_blocks;
+    s.allocations += t.allocations;
+    return s;
+  }
+  // calls visit(e, f, log p) for the parameters within BEAM_THRESHOLD (a
+  // multiple of the log of the row's largest one) of their row, by source
+  // word
+  template <class F>
+  void ForEachExported(double BEAM_THRESHOLD, F visit) const {
     for (unsigned i = 0; i < ttable.size(); ++i) {
-      const std::string& a = d.Convert(i);
+      if (const double* dense = dense_ttable_[i]) {
+        const DenseRow& r = dense_row_of_[i];
+        double max_p = -1;
+        for (unsigned f = 0; f < r.width; ++f)
+          if (dense[f] > max_p) max_p = dense[f];
+        const double threshold = - log(max_p) * BEAM_THRESHOLD;
+        for (unsigned w = 0; w < Words(r.width); ++w) {
+          for (uint64_t bits = r.present[w]; bits; bits &= bits - 1) {
+            const unsigned f = 64 * w + __builtin_ctzll(bits);
+            double c = log(dense[f]);
+            if (c >= threshold)
+              visit(i, f, c);
+          }
+        }
+        continue;
+      }
       const Word2Double& cpd = ttable[i];
       double max_p = -1;
       for (auto& it : cpd)
         if (it.second > max_p) max_p = it.second;
       const double threshold = - log(max_p) * BEAM_THRESHOLD;
       for (auto& it : cpd) {
-        const std::string& b = d.Convert(it.first);
         double c = log(it.second);
         if (c >= threshold)
-          file << a << '\t' << b << '\t' << c << std::endl;
+          visit(i, it.first, c);
       }
     }
+  }
+  void ExportToFile(const char* filename, Dict& d, double BEAM_THRESHOLD) const {
+    std::ofstream file(filename);
+    ForEachExported(BEAM_THRESHOLD, [&](unsigned e, unsigned f, double c) {
+      file << d.Convert(e) << '\t' << d.Convert(f) << '\t' << c << std::endl;
+    });
     file.close();
   }
  private:
+  struct DenseRow {
+    unsigned e;
+    unsigned width;     // 1 + the largest target word of the row
+    uint64_t* present;  // bitmap of the target words with a parameter
+  };
+  static unsigned Words(unsigned width) { return (width + 63) / 64; }
+  static bool IsPresent(const DenseRow& r, unsigned f) {
+    return (r.present[f / 64] >> (f % 64)) & 1;
+  }
+  // the count array of row e if it is dense, else NULL
+  const double* DenseCounts(unsigned e) const {
+    return e < dense_counts_.size() ? dense_counts_[e] : NULL;
+  }
+  // adds x to the count of (e, f) for operator+=; a sparse row gets a new
+  // entry if it doesn't have f, but a dense row can't take new target
+  // words, so their counts are dropped
+  void AddCount(unsigned e, unsigned f, double x) {
+    if (e < dense_counts_.size() && dense_counts_[e]) {
+      const DenseRow& r = dense_row_of_[e];
+      if (f < r.width && IsPresent(r, f)) dense_counts_[e][f] += x;
+      return;
+    }
+    counts[e][f] += x;
+  }
+
+  // moves the rows that are dense enough out of the hash maps into arrays
+  // (the NULL row and those of frequent function words, which take most
+  // of the E-step lookups)
+  void MakeDenseRows() {
+    dense_ttable_.assign(counts.size(), NULL);
+    dense_counts_.assign(counts.size(), NULL);
+    dense_row_of_.assign(counts.size(), DenseRow());
+    for (unsigned i = 0; i < counts.size(); ++i) {
+      if (counts[i].size() < kMinDenseEntries) continue;
+      unsigned width = 0;
+      for (const auto& it : counts[i])
+        width = std::max(width, it.first + 1);
+      if (counts[i].size() < dense_threshold * width) continue;
+      DenseRow r;
+      r.e = i;
+      r.width = width;
+      r.present = static_cast<uint64_t*>(
+          arena_.Allocate(Words(width) * sizeof(uint64_t)));
+      memset(r.present, 0, Words(width) * sizeof(uint64_t));
+      double* t = static_cast<double*>(arena_.Allocate(width * sizeof(double)));
+      double* c = static_cast<double*>(arena_.Allocate(width * sizeof(double)));
+      memset(t, 0, width * sizeof(double));
+      memset(c, 0, width * sizeof(double));
+      for (const auto& it : counts[i]) {
+        r.present[it.first / 64] |= uint64_t(1) << (it.first % 64);
+        t[it.first] = c[it.first] = it.second;
+      }
+      dense_ttable_[i] = t;
+      dense_counts_[i] = c;
+      dense_row_of_[i] = r;
+      dense_rows_.push_back(r);
+      counts[i] = NewWord2Double(&arena_);
+    }
+  }
+
+  // probability of a pair in hybrid mode: its entry if it has one, or
+  // else the sketch's estimate
+  double HybridProb(unsigned e, unsigned f) const {
+    if (const double* dense = dense_ttable_[e]) {
+      const DenseRow& r = dense_row_of_[e];
+      if (f < r.width && IsPresent(r, f)) return dense[f];
+    } else {
+      const Word2Double::const_iterator it = ttable[e].find(f);
+      if (it != ttable[e].end()) return it->second;
+    }
+    const double c = tail_probs_.Estimate(e, f);
+    if (c <= 0) return 1e-9;
+    if (tail_vb_)
+      return std::exp(VMath::Digamma(c + tail_alpha_) - tail_norm_[e]);
+    return c * tail_norm_[e];
+  }
+  void HybridIncrement(unsigned e, unsigned f, double x) {
+    if (double* dense = dense_counts_[e]) {
+      const DenseRow& r = dense_row_of_[e];
+      if (f < r.width && IsPresent(r, f)) {
+        dense[f] += x;
+        return;
+      }
+    } else {
+      const Word2Double::iterator it = counts[e].find(f);
+      if (it != counts[e].end()) {
+        it->second += x;
+        return;
+      }
+    }
+    tail_counts_.Add(e, f, x);
+    tail_totals_[e] += x;
+  }
+  // the sketched part of the total of row e in Normalize* (x + alpha over
+  // its pairs)
+  double TailTotal(unsigned e, double alpha) const {
+    if (tail_totals_.empty()) return 0;
+    return tail_totals_[e] + alpha * tail_entries_[e];
+  }
+  // what HybridProb needs of the total of row e: 1 / total, or with VB the
+  // digamma of it
+  void SetTailNorm(unsigned e, double norm) {
+    if (!tail_norm_.empty()) tail_norm_[e] = norm;
+  }
+  // the sketched counts become the probabilities, as the tables do in
+  // Normalize*
+  void SwapTail(bool vb, double alpha) {
+    if (tail_counts_.empty()) return;
+    tail_vb_ = vb;
+    tail_alpha_ = alpha;
+    tail_probs_.swap(tail_counts_);
+    tail_counts_.Clear();
+    std::fill(tail_totals_.begin(), tail_totals_.end(), 0);
+  }
+
   void ClearCounts() {
 #pragma omp parallel for schedule(dynamic)
-    for (size_t i=0; i<counts.size();++i) {
-      for (auto& cnt : counts[i]) {
-        cnt.second = 0.0;
+    for (unsigned k = 0; k < spans_.size(); ++k) {
+      const Span& s = spans_[k];
+      if (s.split) {
+        Clear(s.row, s.first, s.last);
+      } else {
+        for (unsigned i = s.row; i < s.row_end; ++i)
+          Clear(i, 0, Slots(i));
       }
     }
   }
 
+  // A piece of the work of the passes over all parameters: the whole rows
+  // [row, row_end), or the slots [first, last) of a row too big for one
+  // piece (for a dense row, the target words [first, last)). Rows are
+  // extremely skewed, so without splitting one thread would be left with
+  // the biggest rows while the others wait.
+  struct Span {
+    unsigned row, row_end;
+    size_t first, last;
+    bool split;
+  };
+  static const size_t kSpanEntries = 1 << 14;  // a multiple of 64
+
+  // slots of row i, or its width if it is dense
+  size_t Slots(unsigned i) const {
+    return dense_counts_[i] ? dense_row_of_[i].width : Word2DoubleSlots(counts[i]);
+  }
+
+  void MakeSpans() {
+    spans_.clear();
+    Span group = { 0, 0, 0, 0, false };
+    size_t group_entries = 0;
+    for (unsigned i = 0; i < counts.size(); ++i) {
+      const size_t slots = Slots(i);
+      if (slots > kSpanEntries) {
+        if (group.row < i) {
+          group.row_end = i;
+          spans_.push_back(group);
+        }
+        for (size_t first = 0; first < slots; first += kSpanEntries) {
+          const Span piece = { i, i + 1, first,
+                               std::min(slots, first + kSpanEntries), true };
+          spans_.push_back(piece);
+        }
+        group.row = i + 1;
+        group_entries = 0;
+        continue;
+      }
+      group_entries += counts[i].size() + 1;
+      if (group_entries >= kSpanEntries) {
+        group.row_end = i + 1;
+        spans_.push_back(group);
+        group.row = i + 1;
+        group_entries = 0;
+      }
+    }
+    if (group.row < counts.size()) {
+      group.row_end = counts.size();
+      spans_.push_back(group);
+    }
+  }
+
+  // replaces totals[k] of every split span by the total of its row, summed
+  // over the pieces in order (with the row's sketched pairs)
+  void RowTotals(double alpha, std::vector<double>* totals) {
+    for (unsigned k = 0; k < spans_.size(); ) {
+      if (!spans_[k].split) {
+        ++k;
+        continue;
+      }
+      unsigned end = k;
+      double tot = 0;
+      for (; end < spans_.size() && spans_[end].split &&
+             spans_[end].row == spans_[k].row; ++end)
+        tot += (*totals)[end];
+      tot += TailTotal(spans_[k].row, alpha);
+      if (!tail_norm_.empty())
+        tail_norm_[spans_[k].row] = alpha ? VMath::Digamma(tot ? tot : 1)
+                                          : 1 / (tot ? tot : 1);
+      for (; k < end; ++k)
+        (*totals)[k] = tot;
+    }
+  }
+
+  // the following work on part [first, last) of row i of ttable (after
+  // the swap in Normalize*, i.e. the counts being normalized)
+
+  // sum of x + alpha over the parameters
+  double Sum(unsigned i, size_t first, size_t last, double alpha) {
+    double tot = 0;
+    if (const double* cpd = dense_ttable_[i]) {
+      // target words without a parameter hold 0
+      const DenseRow& r = dense_row_of_[i];
+      for (size_t f = first; f < last; ++f)
+        tot += cpd[f];
+      if (alpha) {
+        size_t n = 0;
+        for (size_t w = first / 64; w < Words(last); ++w)
+          n += __builtin_popcountll(r.present[w]);
+        tot += n * alpha;
+      }
+    } else {
+      ForEachInSlots(ttable[i], first, last,
+                     [&tot, alpha](double& x) { tot += x + alpha; });
+    }
+    return tot;
+  }
+  void Divide(unsigned i, size_t first, size_t last, double tot) {
+    if (double* cpd = dense_ttable_[i]) {
+      for (size_t f = first; f < last; ++f)
+        cpd[f] /= tot;
+    } else {
+      ForEachInSlots(ttable[i], first, last, [tot](double& x) { x /= tot; });
+    }
+  }
+  // x = exp(digamma(x + alpha) - digamma_tot), on a copy of the values in
+  // buf so the arithmetic runs over a contiguous array
+  void DigammaExp(unsigned i, size_t first, size_t last, double alpha,
+                  double digamma_tot, std::vector<double>* buf) {
+    if (double* cpd = dense_ttable_[i]) {
+      VMath::DigammaExp(cpd + first, last - first, alpha, digamma_tot);
+      // back to 0 for the target words without a parameter
+      const DenseRow& r = dense_row_of_[i];
+      for (size_t f = first; f < last; ++f)
+        cpd[f] = IsPresent(r, f) ? cpd[f] : 0;
+      return;
+    }
+    buf->clear();
+    ForEachInSlots(ttable[i], first, last,
+                   [buf](double& x) { buf->push_back(x); });
+    if (buf->empty()) return;
+    VMath::DigammaExp(&(*buf)[0], buf->size(), alpha, digamma_tot);
+    const double* y = &(*buf)[0];
+    ForEachInSlots(ttable[i], first, last, [&y](double& x) { x = *y++; });
+  }
+  // on counts
+  void Clear(unsigned i, size_t first, size_t last) {
+    if (double* cpd = dense_counts_[i])
+      memset(cpd + first, 0, (last - first) * sizeof(double));
+    else
+      ForEachInSlots(counts[i], first, last, [](double& x) { x = 0.0; });
+  }
+
+  // declared before the tables so they outlive the rows
+  RowArena arena_;         // rows after Freeze()
+  RowArena insert_arena_;  // rows while they grow through Insert()
   Word2Word2Double ttable;
   Word2Word2Double counts;
+  // arrays of the dense rows, by source word (NULL for rows in hash maps);
+  // they live in arena_
+  std::vector<double*> dense_ttable_;
+  std::vector<double*> dense_counts_;
+  std::vector<DenseRow> dense_rows_;
+  // the same by source word (width 0 for rows in hash maps), for the
+  // lookups that have to tell the target words of a dense row apart
+  std::vector<DenseRow> dense_row_of_;
+  std::vector<Span> spans_;  // see MakeSpans()
+  // hybrid mode (see EnableTail), by source word where per row
+  CountMinSketch<float> tail_probs_;
+  CountMinSketch<float> tail_counts_;
+  std::vector<double> tail_totals_;   // of the expected counts in the sketch
+  std::vector<double> tail_norm_;     // see SetTailNorm()
+  std::vector<double> tail_entries_;  // see AddTailEntries()
+  bool tail_vb_;                      // tail_norm_ is for NormalizeVB
+  double tail_alpha_;
   bool frozen_; // Disallow new e,f pairs to be added to counts
   bool probs_initialized_; // If we can use the values in probs
 
  public:
-  void DeserializeLogProbsFromText(std::istream* in, Dict& d);
+  // returns the number of parameters read
+  size_t DeserializeLogProbsFromText(std::istream* in, Dict& d);
 };
 
 #endif